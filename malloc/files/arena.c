@@ -0,0 +1,133 @@
+/*
+ * arena.c - region allocation on top of the mm package.
+ *
+ * An arena hands out 8-byte aligned blocks by bumping a pointer through
+ * chunks it gets from mm_malloc. Blocks carry no header and are never
+ * freed one by one: arena_reset frees them all at once, keeping the first
+ * chunk for reuse, and arena_destroy frees the arena as well.
+ *
+ * Chunks are linked through a small header at their start. A request too
+ * large for a quarter of a chunk gets a chunk of its own, linked in
+ * behind the current one so the space left there is not lost.
+ */
+#include <stdlib.h>
+
+#include "arena.h"
+#include "mm.h"
+
+#define ALIGN(size) (((size) + 7) & ~(size_t)0x7)
+
+/* the header of an arena chunk */
+typedef struct chunk {
+    struct chunk *next;      /* chunk obtained before this one */
+    size_t size;             /* payload bytes */
+} chunk_t;
+
+#define CHUNK_HDR ALIGN(sizeof(chunk_t))
+
+struct arena {
+    chunk_t *chunks;         /* chunks in use, the current one first */
+    char *ptr;               /* next free byte of the current chunk */
+    char *end;               /* end of the current chunk */
+    size_t chunk;            /* payload bytes of a regular chunk */
+};
+
+/* 
+ * arena_create - Make an empty arena that gets chunk bytes at a time
+ *    (ARENA_CHUNK if chunk is 0). Returns NULL if out of memory.
+ */
+arena_t *arena_create(size_t chunk)
+{
+    arena_t *a;
+
+    if ((a = mm_malloc(sizeof(arena_t))) == NULL)
+	return NULL;
+    a->chunks = NULL;
+    a->ptr = a->end = NULL;
+    a->chunk = ALIGN(chunk ? chunk : ARENA_CHUNK);
+    return a;
+}
+
+/* 
+ * arena_alloc - Allocate size bytes from arena a. Returns NULL if out of
+ *    memory or if size is 0.
+ */
+void *arena_alloc(arena_t *a, size_t size)
+{
+    chunk_t *c;
+    char *p;
+
+    if (size == 0 || size > (size_t)-1 - CHUNK_HDR - 7)
+	return NULL;
+    size = ALIGN(size);
+    if (size <= (size_t)(a->end - a->ptr)) {	/* the common case */
+	p = a->ptr;
+	a->ptr += size;
+	return p;
+    }
+
+    /* Big requests get a chunk of their own behind the current one */
+    if (size > a->chunk / 4) {
+	if ((c = mm_malloc(CHUNK_HDR + size)) == NULL)
+	    return NULL;
+	c->size = size;
+	if (a->chunks != NULL) {
+	    c->next = a->chunks->next;
+	    a->chunks->next = c;
+	}
+	else {
+	    /* nothing to bump from yet: leave the arena without a current chunk */
+	    c->next = NULL;
+	    a->chunks = c;
+	}
+	return (char *)c + CHUNK_HDR;
+    }
+
+    if ((c = mm_malloc(CHUNK_HDR + a->chunk)) == NULL)
+	return NULL;
+    c->size = a->chunk;
+    c->next = a->chunks;
+    a->chunks = c;
+    p = (char *)c + CHUNK_HDR;
+    a->ptr = p + size;
+    a->end = p + a->chunk;
+    return p;
+}
+
+/* 
+ * arena_reset - Free every block of arena a at once. The arena keeps one
+ *    regular chunk, so refilling it needs no call to mm_malloc right away.
+ */
+void arena_reset(arena_t *a)
+{
+    chunk_t *c, *next, *keep = NULL;
+
+    for (c = a->chunks; c != NULL; c = next) {
+	next = c->next;
+	if (keep == NULL && c->size == a->chunk)
+	    keep = c;
+	else
+	    mm_free(c);
+    }
+    a->chunks = keep;
+    a->ptr = a->end = NULL;
+    if (keep != NULL) {
+	keep->next = NULL;
+	a->ptr = (char *)keep + CHUNK_HDR;
+	a->end = a->ptr + a->chunk;
+    }
+}
+
+/* 
+ * arena_destroy - Free arena a and every block allocated from it.
+ */
+void arena_destroy(arena_t *a)
+{
+    chunk_t *c, *next;
+
+    for (c = a->chunks; c != NULL; c = next) {
+	next = c->next;
+	mm_free(c);
+    }
+    mm_free(a);
+}
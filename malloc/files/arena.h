@@ -0,0 +1,14 @@
+/*
+ * arena.h - region allocation on top of the mm package. Not to be
+ * confused with the memlib arenas (mem_arena_*), which are whole heaps.
+ */
+#include <stddef.h>
+
+typedef struct arena arena_t;
+
+#define ARENA_CHUNK 4096   /* default bytes per chunk */
+
+arena_t *arena_create(size_t chunk);
+void *arena_alloc(arena_t *a, size_t size);
+void arena_reset(arena_t *a);
+void arena_destroy(arena_t *a);
@@ -0,0 +1,257 @@
+/*
+ * buddy.c - A binary buddy implementation of the mm interface.
+ *
+ * Every block holds a power of two bytes, 2^k for some order k, and
+ * starts at an offset from the heap base that is a multiple of its size.
+ * The buddy of a block is then found by flipping bit k of its offset, so
+ * free merges a block with its buddy, and the result with its own buddy,
+ * without footers or looking at any other neighbour: the buddy is free
+ * and whole exactly when its header reads free and of order k.
+ *
+ * A block starts with an 8-byte header holding its order and whether it
+ * is allocated; a free block also holds the two links of the free list
+ * of its order, as 32-bit offsets from the heap base. A bitmap of
+ * non-empty orders finds the smallest free block that fits. Larger free
+ * blocks are halved down to the order needed.
+ *
+ * The heap grows by as little as a block of the order needed takes at
+ * the first suitable boundary; the gap up to it becomes free blocks too.
+ * A growing realloc merges with its free upper buddies in place, growing
+ * the heap for one when the block ends it.
+ *
+ * Rounding every request up to a power of two wastes up to half of each
+ * block; in exchange, malloc and free take O(log n) steps. The package is
+ * not thread-safe.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddy.h"
+#include "memlib.h"
+
+#define ALIGNMENT	8
+#define ALIGN(size)	(((size) + (ALIGNMENT-1)) & ~0x7)
+
+#define WSIZE	4
+#define DSIZE	8
+
+#define GET(p)	(*(unsigned int *)(p))
+#define PUT(p, val)	(*(unsigned int *)(p) = (val))
+
+// block header: the order and the allocated bit
+#define PACK(k, alloc)	((unsigned int)(k) << 1 | (alloc))
+#define GET_ORDER(bp)	(GET(bp) >> 1)
+#define GET_ALLOC(bp)	(GET(bp) & 0x1)
+
+#define MIN_ORDER	4	// a header and the two links
+#define MAX_ORDER	30	// largest block; offsets must fit 32 bits
+#define NUM_ORDERS	(MAX_ORDER+1)
+
+// block pointers are block starts, and offsets count from the heap base
+#define OFF(bp)	((unsigned int)((char *)(bp) - base))
+#define BLK(off)	(base + (off))
+#define BUDDY(bp, k)	BLK(OFF(bp) ^ (1u << (k)))
+
+// free list links, offset+1 so that 0 is the null link
+#define NEXT_FREE(bp)	(GET((char *)(bp) + WSIZE) ? BLK(GET((char *)(bp) + WSIZE) - 1) : NULL)
+#define PREV_FREE(bp)	(GET((char *)(bp) + DSIZE) ? BLK(GET((char *)(bp) + DSIZE) - 1) : NULL)
+#define SET_NEXT(bp, p)	PUT((char *)(bp) + WSIZE, (p) ? OFF(p) + 1 : 0)
+#define SET_PREV(bp, p)	PUT((char *)(bp) + DSIZE, (p) ? OFF(p) + 1 : 0)
+
+// allocator state at the start of the heap
+typedef struct {
+	unsigned int free_map;	// bit k set iff head[k] is non-empty
+	unsigned int head[NUM_ORDERS];	// free lists, offset+1 of the first block
+	unsigned int size;	// bytes from the base to the brk
+} buddy_root_t;
+
+#define ROOT	((buddy_root_t *)heap_lo)
+#define ROOT_SIZE	ALIGN(sizeof(buddy_root_t))
+
+static char *heap_lo;
+static char *base;	// first byte after the root: offset 0 of every block
+
+static int order(size_t size);
+static int extend(size_t bytes);
+static char *take(int k);
+static void push(char *bp, int k);
+static void unlink_free(char *bp, int k);
+static void release(char *bp, int k);
+
+/*
+ * buddy_init - initialize the package on an empty heap.
+ */
+int buddy_init(void)
+{
+	if((heap_lo = mem_sbrk(ROOT_SIZE)) == (void *)-1)
+		return -1;
+	memset(ROOT, 0, ROOT_SIZE);
+	base = heap_lo + ROOT_SIZE;
+	return 0;
+}
+
+/*
+ * buddy_malloc - Allocate a block of the smallest order holding size
+ *     bytes and the header.
+ */
+void *buddy_malloc(size_t size)
+{
+	char *bp;
+	int k;
+	if(size == 0 || (k = order(size + DSIZE)) > MAX_ORDER)
+		return NULL;
+	if((bp = take(k)) == NULL)
+		return NULL;
+	return bp + DSIZE;
+}
+
+/*
+ * buddy_free - Free a block, merging it with its free buddies.
+ */
+void buddy_free(void *ptr)
+{
+	if(ptr == NULL)
+		return;
+	char *bp = (char *)ptr - DSIZE;
+	release(bp, GET_ORDER(bp));
+}
+
+/*
+ * buddy_realloc - Halve a block in place while it shrinks, merge it with
+ *     its free upper buddies while it grows, and move it otherwise.
+ */
+void *buddy_realloc(void *ptr, size_t size)
+{
+	if(ptr == NULL)
+		return buddy_malloc(size);
+	if(size == 0) {
+		buddy_free(ptr);
+		return NULL;
+	}
+	char *bp = (char *)ptr - DSIZE;
+	int k = GET_ORDER(bp);
+	int want;
+	if((want = order(size + DSIZE)) > MAX_ORDER)
+		return NULL;
+	// give back the upper halves
+	while(k > want) {
+		k--;
+		push(bp + (1u << k), k);
+	}
+	// take the upper buddies while they are free, growing a block that
+	// ends the heap
+	while(k < want && (OFF(bp) & (1u << k)) == 0) {
+		char *buddy = bp + (1u << k);
+		if(OFF(buddy) + (1u << k) > ROOT->size && extend(OFF(buddy) + (1u << k) - ROOT->size) < 0)
+			break;
+		if(OFF(buddy) + (1u << k) > ROOT->size || GET(buddy) != PACK(k, 0))
+			break;
+		unlink_free(buddy, k);
+		k++;
+	}
+	PUT(bp, PACK(k, 1));
+	if(k >= want)
+		return ptr;
+	void *newptr;
+	if((newptr = buddy_malloc(size)) == NULL)
+		return NULL;
+	memcpy(newptr, ptr, (1u << k) - DSIZE);
+	release(bp, k);
+	return newptr;
+}
+
+// smallest order whose blocks hold size bytes
+static int order(size_t size) {
+	if(size <= (1u << MIN_ORDER))
+		return MIN_ORDER;
+	if(size > (1u << MAX_ORDER))
+		return MAX_ORDER + 1;
+	return 32 - __builtin_clz((unsigned int)size - 1);
+}
+
+// grow the heap by bytes, cutting the new space into the largest aligned
+// free blocks, which merge with free buddies below
+static int extend(size_t bytes) {
+	unsigned int off = ROOT->size;
+	unsigned int end;
+	if(bytes > (1u << MAX_ORDER) || (size_t)off + bytes > (2u << MAX_ORDER))
+		return -1;
+	if(mem_sbrk((int)bytes) == (void *)-1)
+		return -1;
+	end = off + bytes;
+	while(off < end) {
+		int k = off ? __builtin_ctz(off) : MAX_ORDER;
+		while(k > MAX_ORDER || off + (1u << k) > end)
+			k--;
+		// the heap ends at this block while it merges, so that release
+		// never reads the new space above it, which may hold stale
+		// headers from an earlier run
+		ROOT->size = off + (1u << k);
+		release(BLK(off), k);
+		off += 1u << k;
+	}
+	return 0;
+}
+
+// allocate a block of order k, halving a larger one or growing the heap
+static char *take(int k) {
+	unsigned int map = ROOT->free_map & (~0u << k);
+	char *bp;
+	int j;
+	if(map == 0) {
+		// one block of order k at the first boundary past the brk
+		size_t size = (size_t)1 << k;
+		size_t start = ((size_t)ROOT->size + size - 1) & ~(size - 1);
+		if(extend(start + size - ROOT->size) < 0)
+			return NULL;
+		map = ROOT->free_map & (~0u << k);
+	}
+	j = __builtin_ctz(map);
+	bp = BLK(ROOT->head[j] - 1);
+	unlink_free(bp, j);
+	while(j > k) {
+		j--;
+		push(bp + (1u << j), j);
+	}
+	PUT(bp, PACK(k, 1));
+	return bp;
+}
+
+// mark bp a free block of order k and put it on its list
+static void push(char *bp, int k) {
+	char *head = ROOT->head[k] ? BLK(ROOT->head[k] - 1) : NULL;
+	PUT(bp, PACK(k, 0));
+	SET_NEXT(bp, head);
+	SET_PREV(bp, NULL);
+	if(head != NULL)
+		SET_PREV(head, bp);
+	ROOT->head[k] = OFF(bp) + 1;
+	ROOT->free_map |= 1u << k;
+}
+
+// take the free block bp of order k off its list
+static void unlink_free(char *bp, int k) {
+	char *next = NEXT_FREE(bp);
+	char *prev = PREV_FREE(bp);
+	if(next != NULL)
+		SET_PREV(next, prev);
+	if(prev != NULL)
+		SET_NEXT(prev, next);
+	else if((ROOT->head[k] = next ? OFF(next) + 1 : 0) == 0)
+		ROOT->free_map &= ~(1u << k);
+}
+
+// free the block bp of order k, merging it with its free buddies
+static void release(char *bp, int k) {
+	while(k < MAX_ORDER) {
+		char *buddy = BUDDY(bp, k);
+		if(OFF(buddy) + (1u << k) > ROOT->size || GET(buddy) != PACK(k, 0))
+			break;
+		unlink_free(buddy, k);
+		if(buddy < bp)
+			bp = buddy;
+		k++;
+	}
+	push(bp, k);
+}
@@ -0,0 +1,10 @@
+/*
+ * buddy.h - the mm interface implemented by a binary buddy allocator
+ * (mdriver -m buddy)
+ */
+#include <stddef.h>
+
+extern int buddy_init(void);
+extern void *buddy_malloc(size_t size);
+extern void buddy_free(void *ptr);
+extern void *buddy_realloc(void *ptr, size_t size);
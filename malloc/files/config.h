@@ -58,9 +58,27 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. Override with -DMAX_HEAP=... for larger
+ * heaps; mm.c encodes free list links as 32-bit heap offsets, so
+ * anything up to 4 GB works on a 64-bit host.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#ifndef MAX_HEAP
+#define MAX_HEAP ((size_t)20*(1<<20))  /* 20 MB */
+#endif
+
+/*
+ * Maximum heap size in bytes of the mmap-backed memlib arenas (mdriver
+ * -M/-H). This is only reserved address space; pages are committed as
+ * the heap grows. mm.c offsets limit a heap to 4 GB.
+ */
+#ifndef MMAP_HEAP
+#define MMAP_HEAP (sizeof(void *) == 8 ? (size_t)3 << 30 : MAX_HEAP)  /* 3 GB */
+#endif
+
+/*
+ * Maximum number of independent heaps (memlib arenas)
+ */
+#define MAX_ARENAS 64
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
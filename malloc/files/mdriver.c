@@ -15,8 +15,14 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
+#include "tlsf.h"
+#include "buddy.h"
+#include "arena.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
@@ -29,9 +35,17 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAXTHREADS    64 /* max number of replay threads (-T) */
+#define BATCH_MAX    256 /* max requests replayed by one batch call (-B) */
+
+/* Calls replay_valid serves a trace with */
+#define REPLAY_IMPL   0 /* the tested package's malloc, realloc and free */
+#define REPLAY_BATCH  1 /* mm_malloc_batch and mm_free_batch on runs (-B) */
+#define REPLAY_SIZED  2 /* mm_malloc_class and mm_free_sized (-s) */
+#define REPLAY_CALLOC 3 /* mm_calloc, checking for zeroed blocks (-z) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -49,6 +63,7 @@ typedef struct {
     enum {ALLOC, FREE, REALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of an 'm' request, or 0 */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -57,9 +72,11 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
+    int num_aligned;     /* number of aligned ('m') requests */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    mm_handle_t *handles; /* handles from mm_halloc, for -C */
 } trace_t;
 
 /* 
@@ -70,8 +87,38 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    int nthreads;    /* number of concurrent replays (eval_mm_mt_speed) */
+    int *arenas;     /* memlib arena of each replay, or NULL to share one */
+    int nops;        /* requests replayed up to the peak (eval_snap_*) */
+    size_t budget;   /* bytes per compaction slice (eval_mm_handle_speed) */
 } speed_t;
 
+/* One thread's share of a concurrent replay */
+typedef struct {
+    trace_t *trace;
+    int arena;       /* memlib arena to replay in, or -1 for the shared one */
+} replay_t;
+
+/* An implementation of the mm interface (-m) */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*memalign)(size_t align, size_t size); /* NULL if unsupported */
+} mm_impl_t;
+
+/* Times saving and restoring the heap of a trace at its peak (-w) */
+typedef struct {
+    int valid;       /* did the restored heap hold the saved blocks? */
+    size_t heap;     /* bytes saved, heap plus mappings */
+    double build;    /* secs to replay the trace up to its peak */
+    double save;     /* secs for mem_snapshot */
+    double restore;  /* secs for mem_restore and mm_attach, touching
+			every heap page */
+} snap_stats_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +128,9 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak;     /* largest heap plus mapped size during the trace
+			(0 for libc) */
+    size_t final;    /* heap plus mapped size left once the trace has run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -92,6 +142,18 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* The implementations of the mm interface and the one tested (-m) */
+static mm_impl_t impls[] = {
+    {"seg",  mm_init,   mm_malloc,   mm_free,   mm_realloc,   mm_memalign},
+    {"tlsf", tlsf_init, tlsf_malloc, tlsf_free, tlsf_realloc, NULL},
+    {"buddy", buddy_init, buddy_malloc, buddy_free, buddy_realloc, NULL},
+    {NULL}
+};
+static mm_impl_t *impl = &impls[0];
+
+/* File the heap snapshots go to (-w) */
+static char snapfile[MAXLINE];
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -116,17 +178,52 @@ static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
+static void *libc_alloc(traceop_t *op);
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static stats_t *eval_mm(int n, char **tracefiles, range_t **ranges);
+static void *impl_alloc(traceop_t *op);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static char *replay_alloc(trace_t *trace, int i, int n, int mode,
+			  void **blocks);
+static int replay_valid(trace_t *trace, int tracenum, range_t **ranges,
+			int mode, double *util);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static int batch_run(trace_t *trace, int i);
+static void eval_mm_batch_speed(void *ptr);
+static void *sized_malloc(size_t size);
+static void eval_mm_sized_speed(void *ptr);
+static void zero_replay(trace_t *trace, int use_calloc);
+static void eval_mm_calloc_speed(void *ptr);
+static void eval_mm_memset_speed(void *ptr);
+static int handle_check(mm_handle_t h, int index, int size, int tracenum,
+			int opnum);
+static int eval_mm_handle_valid(trace_t *trace, int tracenum, size_t budget,
+				double *util);
+static void eval_mm_handle_speed(void *ptr);
+static int arena_replay(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_arena_valid(trace_t *trace, int tracenum, range_t **ranges,
+			    double *util);
+static void eval_arena_speed(void *ptr);
+static int snap_peak(trace_t *trace);
+static int snap_build(trace_t *trace, int nops);
+static int eval_snap_valid(trace_t *trace, int tracenum, int nops);
+static void eval_snap_build(void *ptr);
+static void eval_snap_save(void *ptr);
+static void eval_snap_restore(void *ptr);
+#ifdef MM_THREADS
+static void *replay_trace(void *ptr);
+static void eval_mm_mt_speed(void *ptr);
+#endif
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printcompare(int n, int m, char **names, stats_t **stats);
+static void printsnap(int n, snap_stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -137,7 +234,7 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, j;
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
@@ -145,10 +242,31 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *batch_stats = NULL; /* mm stats using the batch calls (-B) */
+    stats_t *sized_stats = NULL; /* mm stats using the sized calls (-s) */
+    stats_t *calloc_stats = NULL; /* mm stats using mm_calloc (-z) */
+    stats_t *memset_stats = NULL; /* ... and mm_malloc plus memset */
+    stats_t *handle_stats = NULL; /* mm stats using handles (-C) */
+    stats_t *arena_stats = NULL; /* stats for arenas on top of mm (-R) */
+    snap_stats_t *snap_stats = NULL; /* heap snapshot times (-w) */
+#ifdef MM_THREADS
+    stats_t *mt_stats = NULL;  /* mm stats for multi-threaded replays */
+    int nthreads = 0;          /* If set, also replay traces in this many threads (-T) */
+    int narenas = 0;           /* ... each in its own arena (-A) */
+    int arenas[MAXTHREADS];    /* memlib arena ids for -A */
+#endif
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int batch = 0;       /* If set, also replay with batch calls (set by -B) */
+    int sized = 0;       /* If set, also replay with sized calls (set by -s) */
+    int zero = 0;        /* If set, also replay with zeroed allocations (-z) */
+    size_t budget = 0;   /* If set, also replay with handles, compacting
+			    this many bytes after each free (-C) */
+    int arena = 0;       /* If set, also replay in arenas (set by -R) */
+    int snap = 0;        /* If set, also time heap snapshots (set by -w) */
+    int compare = 0;     /* If set, compare all mm implementations (set by -c) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
 
     /* temporaries used to compute the performance index */
@@ -158,7 +276,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcszwBRT:A:C:r:MHF:S:m:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -181,9 +299,107 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'r': /* Realloc slack: percent[:max bytes], 0 for none */
+            {
+                char *colon = strchr(optarg, ':');
+                mm_set_slack(atoi(optarg), colon ? strtoul(colon+1, NULL, 10)
+                             : 64*1024);
+            }
+            break;
+        case 'M': /* Back the heaps with lazily committed mmap memory */
+            mem_set_backend(MEM_MMAP);
+            break;
+        case 'H': /* ... using transparent huge pages */
+            mem_set_backend(MEM_HUGEPAGE);
+            break;
+        case 'F': /* Fit policy: best, first, next or good[:k] */
+            if (strcmp(optarg, "best") == 0)
+                mm_set_fit(MM_BEST_FIT, 1);
+            else if (strcmp(optarg, "first") == 0)
+                mm_set_fit(MM_FIRST_FIT, 1);
+            else if (strcmp(optarg, "next") == 0)
+                mm_set_fit(MM_NEXT_FIT, 1);
+            else if (strncmp(optarg, "good", 4) == 0)
+                mm_set_fit(MM_GOOD_FIT, optarg[4] == ':' ? atoi(optarg+5) : 4);
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'S': /* Split rule: front, back, adaptive or a size threshold */
+            if (strcmp(optarg, "front") == 0)
+                mm_set_split(MM_SPLIT_FRONT, 0);
+            else if (strcmp(optarg, "back") == 0)
+                mm_set_split(MM_SPLIT_BACK, 0);
+            else if (strcmp(optarg, "adaptive") == 0)
+                mm_set_split(MM_SPLIT_ADAPTIVE, 96);
+            else if (atoi(optarg) > 0)
+                mm_set_split(MM_SPLIT_SIZE, atoi(optarg));
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'm': /* Implementation of the mm interface to test */
+            for (impl = impls; impl->name != NULL; impl++)
+                if (strcmp(optarg, impl->name) == 0)
+                    break;
+            if (impl->name == NULL) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'B': /* Also replay runs of requests with the batch calls */
+            batch = 1;
+            break;
+        case 's': /* Also replay with mm_malloc_class and mm_free_sized */
+            sized = 1;
+            break;
+        case 'z': /* Also replay with mm_calloc, and with malloc and memset */
+            zero = 1;
+            break;
+        case 'C': /* Also replay with handles and incremental compaction */
+            if (atoi(optarg) <= 0) {
+		usage();
+		exit(1);
+	    }
+            budget = atoi(optarg);
+            break;
+        case 'w': /* Also time saving and restoring each heap at its peak */
+            snap = 1;
+            break;
+        case 'R': /* Also replay the traces in arenas */
+            arena = 1;
+            break;
+        case 'c': /* Compare all mm implementations and libc */
+            compare = 1;
+            run_libc = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'T': /* Replay each trace in this many threads at once */
+#ifdef MM_THREADS
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > MAXTHREADS) {
+		usage();
+		exit(1);
+	    }
+#else
+	    app_error("-T needs the thread-safe driver (make mdriver-mt)");
+#endif
+            break;
+        case 'A': /* Replay each trace in this many threads, one arena each */
+#ifdef MM_THREADS
+            narenas = atoi(optarg);
+            if (narenas < 1 || narenas > MAXTHREADS || narenas >= MAX_ARENAS) {
+		usage();
+		exit(1);
+	    }
+#else
+	    app_error("-A needs the thread-safe driver (make mdriver-mt)");
+#endif
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -279,41 +495,297 @@ int main(int argc, char **argv)
     if (verbose > 1)
 	printf("\nTesting mm malloc\n");
 
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    mm_stats = eval_mm(num_tracefiles, tracefiles, &ranges);
 
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	if (impl == impls)
+	    printf("\nResults for mm malloc:\n");
+	else
+	    printf("\nResults for mm malloc (%s):\n", impl->name);
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
 
+    /*
+     * Optionally evaluate every other mm implementation the same way and
+     * show them all next to libc
+     */
+    if (compare) {
+	mm_impl_t *tested = impl;
+	int n = sizeof(impls) / sizeof(impls[0]) - 1;
+	stats_t *cmp_stats[sizeof(impls) / sizeof(impls[0])];
+	char *cmp_names[sizeof(impls) / sizeof(impls[0])];
+
+	for (j = 0; j < n; j++) {
+	    impl = &impls[j];
+	    cmp_names[j] = impl->name;
+	    cmp_stats[j] = (impl == tested) ? mm_stats : 
+		eval_mm(num_tracefiles, tracefiles, &ranges);
+	}
+	impl = tested;
+	cmp_names[n] = "libc";
+	cmp_stats[n] = libc_stats;
+
+	printf("\nResults side by side:\n");
+	printcompare(num_tracefiles, n+1, cmp_names, cmp_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again, turning runs of same-size
+     * allocations into mm_malloc_batch calls and runs of frees into
+     * mm_free_batch calls
+     */
+    if (batch) {
+	batch_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (batch_stats == NULL)
+	    unix_error("batch_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    batch_stats[i].ops = trace->num_ops;
+	    batch_stats[i].valid = 
+		replay_valid(trace, i, &ranges, REPLAY_BATCH, &batch_stats[i].util);
+	    if (batch_stats[i].valid) {
+		batch_stats[i].peak = mem_peak_heapsize();
+		batch_stats[i].final = mem_heapsize() + mem_mapsize();
+		speed_params.trace = trace;
+		batch_stats[i].secs = fsecs(eval_mm_batch_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm malloc with batch calls:\n");
+	printresults(num_tracefiles, batch_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again, passing the size to every
+     * free and the class to every small allocation
+     */
+    if (sized) {
+	sized_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (sized_stats == NULL)
+	    unix_error("sized_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    sized_stats[i].ops = trace->num_ops;
+	    sized_stats[i].valid = 
+		replay_valid(trace, i, &ranges, REPLAY_SIZED, &sized_stats[i].util);
+	    if (sized_stats[i].valid) {
+		sized_stats[i].peak = mem_peak_heapsize();
+		sized_stats[i].final = mem_heapsize() + mem_mapsize();
+		speed_params.trace = trace;
+		sized_stats[i].secs = fsecs(eval_mm_sized_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm malloc with sized calls:\n");
+	printresults(num_tracefiles, sized_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again, zeroing every allocation once
+     * with mm_calloc and once with mm_malloc and memset
+     */
+    if (zero) {
+	calloc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	memset_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (calloc_stats == NULL || memset_stats == NULL)
+	    unix_error("calloc_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    calloc_stats[i].ops = memset_stats[i].ops = trace->num_ops;
+	    calloc_stats[i].valid = 
+		replay_valid(trace, i, &ranges, REPLAY_CALLOC, &calloc_stats[i].util);
+	    if (calloc_stats[i].valid) {
+		calloc_stats[i].peak = mem_peak_heapsize();
+		calloc_stats[i].final = mem_heapsize() + mem_mapsize();
+		memset_stats[i] = calloc_stats[i];
+		speed_params.trace = trace;
+		calloc_stats[i].secs = fsecs(eval_mm_calloc_speed, &speed_params);
+		memset_stats[i].secs = fsecs(eval_mm_memset_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm calloc:\n");
+	printresults(num_tracefiles, calloc_stats);
+	printf("\nResults for mm malloc and memset:\n");
+	printresults(num_tracefiles, memset_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again through handles, running a
+     * compaction slice of budget bytes after every free
+     */
+    if (budget > 0) {
+	handle_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (handle_stats == NULL)
+	    unix_error("handle_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    handle_stats[i].ops = trace->num_ops;
+	    handle_stats[i].valid = 
+		eval_mm_handle_valid(trace, i, budget, &handle_stats[i].util);
+	    if (handle_stats[i].valid) {
+		handle_stats[i].peak = mem_peak_heapsize();
+		handle_stats[i].final = mem_heapsize() + mem_mapsize();
+		speed_params.trace = trace;
+		speed_params.budget = budget;
+		handle_stats[i].secs = fsecs(eval_mm_handle_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm handles, compacting %lu bytes per free:\n",
+	       (unsigned long)budget);
+	printresults(num_tracefiles, handle_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again with arena_alloc, freeing the
+     * blocks allocated between two frees all at once
+     */
+    if (arena) {
+	arena_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (arena_stats == NULL)
+	    unix_error("arena_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    arena_stats[i].ops = trace->num_ops;
+	    arena_stats[i].valid = 
+		eval_arena_valid(trace, i, &ranges, &arena_stats[i].util);
+	    if (arena_stats[i].valid) {
+		arena_stats[i].peak = mem_peak_heapsize();
+		arena_stats[i].final = mem_heapsize() + mem_mapsize();
+		speed_params.trace = trace;
+		arena_stats[i].secs = fsecs(eval_arena_speed, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for arenas on top of mm malloc:\n");
+	printresults(num_tracefiles, arena_stats);
+	printf("\n");
+    }
+
+#ifdef MM_THREADS
+    /*
+     * Optionally time nthreads threads replaying each trace at once
+     * against the same mm heap. Space utilization is not measured.
+     */
+    if (nthreads > 0) {
+	mt_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (mt_stats == NULL)
+	    unix_error("mt_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mt_stats[i].ops = (double)nthreads * trace->num_ops;
+	    mt_stats[i].valid = 1;
+	    speed_params.trace = trace;
+	    speed_params.nthreads = nthreads;
+	    speed_params.arenas = NULL;
+	    mt_stats[i].secs = fsecs(eval_mm_mt_speed, &speed_params);
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm malloc with %d threads:\n", nthreads);
+	printresults(num_tracefiles, mt_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally do the same with each thread in an arena of its own,
+     * so the threads share neither a heap nor a lock
+     */
+    if (narenas > 0) {
+	for (i=0; i < narenas; i++)
+	    if ((arenas[i] = mem_arena_create()) < 0)
+		app_error("mem_arena_create failed in main");
+
+	if (mt_stats == NULL &&
+	    (mt_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+	    unix_error("mt_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mt_stats[i].ops = (double)narenas * trace->num_ops;
+	    mt_stats[i].valid = 1;
+	    speed_params.trace = trace;
+	    speed_params.nthreads = narenas;
+	    speed_params.arenas = arenas;
+	    mt_stats[i].secs = fsecs(eval_mm_mt_speed, &speed_params);
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm malloc with %d threads in separate arenas:\n", 
+	       narenas);
+	printresults(num_tracefiles, mt_stats);
+	printf("\n");
+    }
+#endif
+
+    /*
+     * Optionally save each trace's heap at its peak to a file and time
+     * that against bringing the heap back, in an mmap-backed arena of
+     * its own
+     */
+    if (snap) {
+	int fd, id;
+
+	snap_stats = (snap_stats_t *)calloc(num_tracefiles, sizeof(snap_stats_t));
+	if (snap_stats == NULL)
+	    unix_error("snap_stats calloc in main failed");
+	strcpy(snapfile, "/tmp/mdriver-snapXXXXXX");
+	if ((fd = mkstemp(snapfile)) < 0)
+	    unix_error("mkstemp failed in main");
+	close(fd);
+	mem_set_backend(MEM_MMAP);
+	if ((id = mem_arena_create()) < 0)
+	    app_error("mem_arena_create failed in main");
+	mem_arena_select(id);
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    speed_params.trace = trace;
+	    speed_params.nops = snap_peak(trace);
+	    snap_stats[i].valid = eval_snap_valid(trace, i, speed_params.nops);
+	    if (snap_stats[i].valid) {
+		snap_stats[i].heap = mem_heapsize() + mem_mapsize();
+		snap_stats[i].build = fsecs(eval_snap_build, &speed_params);
+		snap_stats[i].save = fsecs(eval_snap_save, &speed_params);
+		snap_stats[i].restore = fsecs(eval_snap_restore, &speed_params);
+	    }
+	    free_trace(trace);
+	}
+	mem_arena_select(0);
+	unlink(snapfile);
+
+	printf("\nResults for saving and restoring the heap at its peak:\n");
+	printsnap(num_tracefiles, snap_stats);
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -395,9 +867,11 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or within
+       one of the areas the package mapped separately */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -477,7 +951,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, align;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -514,10 +988,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    /* ... and the handles of the blocks when they are replayed with -C */
+    if ((trace->handles = 
+	 (mm_handle_t *)malloc(trace->num_ids * sizeof(mm_handle_t))) == NULL)
+	unix_error("malloc 5 failed in read_trace");
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
+    trace->num_aligned = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
 	switch(type[0]) {
 	case 'a':
@@ -525,6 +1005,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = 0;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = align;
+	    trace->num_aligned++;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
@@ -532,12 +1022,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = REALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].align = 0;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].align = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -560,9 +1052,10 @@ static trace_t *read_trace(char *tracedir, char *filename)
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    free(trace->ops);         /* free the four arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->handles);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -571,31 +1064,142 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_mm - Evaluate the mm package selected by -m on the n traces,
+ *    returning an array with their stats
+ */
+static stats_t *eval_mm(int n, char **tracefiles, range_t **ranges)
+{
+    int i;
+    trace_t *trace;
+    speed_t speed_params;
+    stats_t *stats;
+
+    /* Allocate the stats array, with one stats_t struct per tracefile */
+    stats = (stats_t *)calloc(n, sizeof(stats_t));
+    if (stats == NULL)
+	unix_error("stats calloc in eval_mm failed");
+
+    for (i=0; i < n; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    stats[i].util = eval_mm_util(trace, i, ranges);
+	    stats[i].peak = mem_peak_heapsize();
+	    stats[i].final = mem_heapsize() + mem_mapsize();
+	    speed_params.trace = trace;
+	    speed_params.ranges = *ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	}
+	free_trace(trace);
+    }
+    return stats;
+}
+
+/*
+ * impl_alloc - Serve an ALLOC request with the tested package's malloc,
+ *    or with its memalign if the request is aligned
+ */
+static void *impl_alloc(traceop_t *op)
+{
+    if (op->align)
+	return impl->memalign(op->align, op->size);
+    return impl->malloc(op->size);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 {
-    int i, j;
+    return replay_valid(trace, tracenum, ranges, REPLAY_IMPL, NULL);
+}
+
+/*
+ * replay_alloc - Serve the allocations from request i on, n of them for
+ *    a batch, the way mode asks; returns an error message, or NULL once
+ *    blocks holds the new blocks
+ */
+static char *replay_alloc(trace_t *trace, int i, int n, int mode,
+			  void **blocks)
+{
+    traceop_t *op = &trace->ops[i];
+
+    /* The tested package's malloc, or its memalign */
+    if (mode == REPLAY_IMPL)
+	return (blocks[0] = impl_alloc(op)) ? NULL : "mm_malloc failed.";
+
+    /* An aligned request is always a single mm_memalign */
+    if (op->align) {
+	if ((blocks[0] = mm_memalign(op->align, op->size)) == NULL)
+	    return "mm_memalign failed.";
+	if (mode == REPLAY_CALLOC)
+	    memset(blocks[0], 0, op->size);
+	return NULL;
+    }
+
+    switch (mode) {
+    case REPLAY_BATCH:
+	return mm_malloc_batch(op->size, n, blocks) == n ? NULL :
+	    "mm_malloc_batch failed.";
+    case REPLAY_SIZED:
+	return (blocks[0] = sized_malloc(op->size)) ? NULL :
+	    "mm_malloc_class failed.";
+    case REPLAY_CALLOC:
+	return (blocks[0] = mm_calloc(1, op->size)) ? NULL :
+	    "mm_calloc failed.";
+    }
+    app_error("Nonexistent replay mode in replay_alloc");
+    return NULL;
+}
+
+/*
+ * replay_valid - Replay a trace through the calls mode picks, checking
+ *    every block the way eval_mm_valid does, and compute the space
+ *    utilization if util is not NULL
+ */
+static int replay_valid(trace_t *trace, int tracenum, range_t **ranges,
+			int mode, double *util)
+{
+    int i, j, k, n;
     int index;
     int size;
     int oldsize;
+    int total_size = 0, max_total_size = 0;
     char *newp;
     char *oldp;
     char *p;
-    
+    char *msg;
+    void *blocks[BATCH_MAX];
+
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
 
+    /* Aligned requests need a package with memalign */
+    if (mode == REPLAY_IMPL && trace->num_aligned && impl->memalign == NULL) {
+	printf("Trace %d has aligned requests, skipped for %s\n",
+	       tracenum, impl->name);
+	return 0;
+    }
+
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if ((mode == REPLAY_IMPL ? impl->init() : mm_init()) < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
 
-    /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
+    /* Interpret each operation in the trace in order, a run at a time
+       for batch calls */
+    for (i = 0;  i < trace->num_ops;  i += n) {
+	n = (mode == REPLAY_BATCH) ? batch_run(trace, i) : 1;
 	index = trace->ops[i].index;
 	size = trace->ops[i].size;
 
@@ -603,57 +1207,80 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case ALLOC: /* mm_malloc */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    /* Call the student's malloc, or memalign for an aligned request */
+	    if ((msg = replay_alloc(trace, i, n, mode, blocks)) != NULL) {
+		malloc_error(tracenum, i, msg);
 		return 0;
 	    }
-	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (trace->ops[i].align && (size_t)blocks[0] % trace->ops[i].align) {
+		malloc_error(tracenum, i, "mm_memalign returned a block "
+			     "that is not aligned as requested.");
 		return 0;
-	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-	    memset(p, index & 0xFF, size);
+	    }
 
-	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+	    for (j = 0; j < n; j++) {
+		index = trace->ops[i+j].index;
+		p = blocks[j];
+
+		/*
+		 * Test the range of the new block for correctness and add it
+		 * to the range list if OK. The block must be  be aligned
+		 * properly, and must not overlap any currently allocated block.
+		 */
+		if (add_range(ranges, p, size, tracenum, i+j) == 0)
+		    return 0;
+
+		/* A block from mm_calloc must read as zero */
+		if (mode == REPLAY_CALLOC) {
+		    for (k = 0; k < size; k++) {
+			if (p[k] != 0) {
+			    malloc_error(tracenum, i, "mm_calloc returned a "
+					 "block that is not zeroed");
+			    return 0;
+			}
+		    }
+		}
+
+		/* ADDED: cgw
+		 * fill range with low byte of index.  This will be used later
+		 * if we realloc the block and wish to make sure that the old
+		 * data was copied to the new block
+		 */
+		memset(p, index & 0xFF, size);
+
+		/* Remember region */
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		total_size += size;
+	    }
 	    break;
 
         case REALLOC: /* mm_realloc */
-	    
+
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = (mode == REPLAY_IMPL) ? impl->realloc(oldp, size) :
+		 mm_realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
-	    
+
 	    /* Remove the old region from the range list */
 	    remove_range(ranges, oldp);
-	    
+
 	    /* Check new block for correctness and add it to range list */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
-	    
+
 	    /* ADDED: cgw
-	     * Make sure that the new block contains the data from the old 
+	     * Make sure that the new block contains the data from the old
 	     * block and then fill in the new block with the low order byte
 	     * of the new index
 	     */
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -662,25 +1289,46 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    memset(newp, index & 0xFF, size);
 
 	    /* Remember region */
+	    total_size += size - trace->block_sizes[index];
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
 	    break;
 
         case FREE: /* mm_free */
-	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+
+	    /* Remove regions from list and call student's free function */
+	    for (j = 0; j < n; j++) {
+		index = trace->ops[i+j].index;
+		blocks[j] = trace->blocks[index];
+		remove_range(ranges, blocks[j]);
+		total_size -= trace->block_sizes[index];
+	    }
+	    switch (mode) {
+	    case REPLAY_IMPL:
+		impl->free(blocks[0]);
+		break;
+	    case REPLAY_BATCH:
+		mm_free_batch(blocks, n);
+		break;
+	    case REPLAY_SIZED:
+		mm_free_sized(blocks[0], trace->block_sizes[index]);
+		break;
+	    case REPLAY_CALLOC:
+		mm_free(blocks[0]);
+		break;
+	    }
 	    break;
 
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+	    app_error("Nonexistent request type in replay_valid");
         }
-
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
     }
 
     /* As far as we know, this is a valid malloc package */
+    if (util != NULL)
+	*util = (double)max_total_size / (double)mem_peak_heapsize();
     return 1;
 }
 
@@ -689,10 +1337,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size the heap, plus any areas mapped with mem_map(),
+ *   reached while running the student's malloc package on the trace.
+ *   The package may trim the heap with a negative mem_sbrk(), so the
+ *   final brk can be below that peak.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -707,7 +1355,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (impl->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -717,7 +1365,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = impl_alloc(&trace->ops[i])) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1387,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = impl->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1408,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    impl->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -774,7 +1422,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -784,13 +1432,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (impl->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -799,8 +1447,7 @@ static void eval_mm_speed(void *ptr)
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = impl_alloc(&trace->ops[i])) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +1456,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = impl->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,7 +1464,7 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            impl->free(block);
             break;
 
 	default:
@@ -826,21 +1473,806 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * batch_run - the number of requests from request i on that one call can
+ *    replay: a run of unaligned allocations of one size, a run of frees,
+ *    or a single realloc or aligned allocation
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static int batch_run(trace_t *trace, int i)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    int j = i + 1;
+
+    if (trace->ops[i].type == REALLOC || trace->ops[i].align)
+	return 1;
+    while (j < trace->num_ops && j - i < BATCH_MAX &&
+	   trace->ops[j].type == trace->ops[i].type &&
+	   (trace->ops[i].type == FREE || 
+	    (trace->ops[j].size == trace->ops[i].size &&
+	     trace->ops[j].align == 0)))
+	j++;
+    return j - i;
+}
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+/*
+ * eval_mm_batch_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm package with batch calls.
+ */
+static void eval_mm_batch_speed(void *ptr)
+{
+    int i, j, n;
+    char *newp;
+    void *blocks[BATCH_MAX];
+    trace_t *trace = ((speed_t *)ptr)->trace;
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_batch_speed");
+
+    for (i = 0;  i < trace->num_ops;  i += n) {
+	n = batch_run(trace, i);
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc_batch, or mm_memalign on its own */
+	    if (trace->ops[i].align) {
+		if ((blocks[0] = mm_memalign(trace->ops[i].align, 
+					     trace->ops[i].size)) == NULL)
+		    app_error("mm_memalign error in eval_mm_batch_speed");
+	    }
+	    else if (mm_malloc_batch(trace->ops[i].size, n, blocks) != n)
+		app_error("mm_malloc_batch error in eval_mm_batch_speed");
+	    for (j = 0; j < n; j++)
+		trace->blocks[trace->ops[i+j].index] = blocks[j];
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    newp = mm_realloc(trace->blocks[trace->ops[i].index], 
+			      trace->ops[i].size);
+	    if (newp == NULL)
+		app_error("mm_realloc error in eval_mm_batch_speed");
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+
+	case FREE: /* mm_free_batch */
+	    for (j = 0; j < n; j++)
+		blocks[j] = trace->blocks[trace->ops[i+j].index];
+	    mm_free_batch(blocks, n);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_batch_speed");
+	}
+    }
+}
+
+/*
+ * sized_malloc - mm_malloc_class for sizes that have a class, mm_malloc
+ *    for the others
+ */
+static void *sized_malloc(size_t size)
+{
+    if (size <= MM_CLASS_SIZE(MM_CLASSES))
+	return mm_malloc_class(MM_CLASS(size));
+    return mm_malloc(size);
+}
+
+/*
+ * eval_mm_sized_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm package with sized calls.
+ */
+static void eval_mm_sized_speed(void *ptr)
+{
+    int i, index;
+    char *p;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_sized_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc_class or mm_malloc */
+	    if ((p = trace->ops[i].align ? 
+		 mm_memalign(trace->ops[i].align, trace->ops[i].size) :
+		 sized_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc_class error in eval_mm_sized_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_sized_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+
+	case FREE: /* mm_free_sized */
+	    mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_sized_speed");
+	}
+    }
+}
+
+/*
+ * zero_replay - Replay a trace, getting every allocation zeroed from
+ *    mm_calloc, or from mm_malloc followed by memset
+ */
+static void zero_replay(trace_t *trace, int use_calloc)
+{
+    int i, index, size;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in zero_replay");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_calloc, or mm_malloc and memset */
+	    if (trace->ops[i].align)
+		p = mm_memalign(trace->ops[i].align, size);
+	    else if (use_calloc)
+		p = mm_calloc(1, size);
+	    else 
+		p = mm_malloc(size);
+	    if (p == NULL)
+		app_error("mm_calloc error in zero_replay");
+	    if (trace->ops[i].align || !use_calloc)
+		memset(p, 0, size);
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in zero_replay");
+	    trace->blocks[index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    mm_free(trace->blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in zero_replay");
+	}
+    }
+}
+
+/*
+ * eval_mm_calloc_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm package with mm_calloc.
+ */
+static void eval_mm_calloc_speed(void *ptr)
+{
+    zero_replay(((speed_t *)ptr)->trace, 1);
+}
+
+/*
+ * eval_mm_memset_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm package with mm_malloc and
+ *    memset.
+ */
+static void eval_mm_memset_speed(void *ptr)
+{
+    zero_replay(((speed_t *)ptr)->trace, 0);
+}
+
+/*
+ * handle_check - Check that the block of handle h lies aligned in the
+ *    heap or a mapping and still holds size bytes of the fill byte of
+ *    index. Blocks move under compaction, so overlaps show up as
+ *    overwritten data rather than through the range list.
+ */
+static int handle_check(mm_handle_t h, int index, int size, int tracenum,
+			int opnum)
+{
+    char *lo, *hi;
+    int j, ok = 1;
+
+    if ((lo = mm_hpin(h)) == NULL) {
+	malloc_error(tracenum, opnum, "mm_hpin failed on a live handle");
+	return 0;
+    }
+    hi = lo + size - 1;
+    if (!IS_ALIGNED(lo)) {
+	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
+		lo, ALIGNMENT);
+	malloc_error(tracenum, opnum, msg);
+	ok = 0;
+    }
+    else if (((lo < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	     !mem_is_mapped(lo, hi)) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+		lo, hi, mem_heap_lo(), mem_heap_hi());
+	malloc_error(tracenum, opnum, msg);
+	ok = 0;
+    }
+    else {
+	for (j = 0; j < size; j++) {
+	    if ((unsigned char)lo[j] != (index & 0xFF)) {
+		malloc_error(tracenum, opnum, "a handle block lost its data");
+		ok = 0;
+		break;
+	    }
+	}
+    }
+    mm_hunpin(h);
+    return ok;
+}
+
+/*
+ * eval_mm_handle_valid - Replay a trace through mm_halloc, mm_hrealloc
+ *    and mm_hfree, running mm_compact after every free, check the data
+ *    of every block as it is touched and at the end, and compute the
+ *    space utilization
+ */
+static int eval_mm_handle_valid(trace_t *trace, int tracenum, size_t budget,
+				double *util)
+{
+    int i, index, size, oldsize;
+    int total_size = 0, max_total_size = 0;
+    mm_handle_t *handles = trace->handles;
+    char *p;
+
+    /* Handles have no alignment beyond the default */
+    if (trace->num_aligned) {
+	printf("Trace %d has aligned requests, skipped for handles\n", 
+	       tracenum);
+	return 0;
+    }
+    memset(handles, 0, trace->num_ids * sizeof(mm_handle_t));
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_halloc */
+	    if ((handles[index] = mm_halloc(size)) == 0) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		return 0;
+	    }
+	    p = mm_hpin(handles[index]);
+	    memset(p, index & 0xFF, size);
+	    mm_hunpin(handles[index]);
+	    if (!handle_check(handles[index], index, size, tracenum, i))
+		return 0;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC: /* mm_hrealloc */
+	    if (mm_hrealloc(handles[index], size) < 0) {
+		malloc_error(tracenum, i, "mm_hrealloc failed.");
+		return 0;
+	    }
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    if (!handle_check(handles[index], index, oldsize, tracenum, i))
+		return 0;
+	    p = mm_hpin(handles[index]);
+	    memset(p, index & 0xFF, size);
+	    mm_hunpin(handles[index]);
+	    total_size += size - trace->block_sizes[index];
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE: /* mm_hfree, then a compaction slice */
+	    if (!handle_check(handles[index], index, 
+			      trace->block_sizes[index], tracenum, i))
+		return 0;
+	    total_size -= trace->block_sizes[index];
+	    mm_hfree(handles[index]);
+	    handles[index] = 0;
+	    mm_compact(budget);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handle_valid");
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+
+    /* Every block left must have come through all the slides intact */
+    for (index = 0; index < trace->num_ids; index++)
+	if (handles[index] != 0 &&
+	    !handle_check(handles[index], index, trace->block_sizes[index], 
+			  tracenum, trace->num_ops - 1))
+	    return 0;
+
+    *util = (double)max_total_size / (double)mem_peak_heapsize();
+    return 1;
+}
+
+/*
+ * eval_mm_handle_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm package through handles,
+ *    pinning each block to write its first byte.
+ */
+static void eval_mm_handle_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    size_t budget = ((speed_t *)ptr)->budget;
+    mm_handle_t *handles = trace->handles;
+    int i, index;
+
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_handle_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_halloc */
+	    if ((handles[index] = mm_halloc(trace->ops[i].size)) == 0)
+		app_error("mm_halloc error in eval_mm_handle_speed");
+	    *(char *)mm_hpin(handles[index]) = 0;
+	    mm_hunpin(handles[index]);
+	    break;
+
+	case REALLOC: /* mm_hrealloc */
+	    if (mm_hrealloc(handles[index], trace->ops[i].size) < 0)
+		app_error("mm_hrealloc error in eval_mm_handle_speed");
+	    break;
+
+	case FREE: /* mm_hfree, then a compaction slice */
+	    mm_hfree(handles[index]);
+	    mm_compact(budget);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handle_speed");
+	}
+    }
+}
+
+/*
+ * arena_replay - Replay a trace with arena_alloc. Blocks are grouped by
+ *    lifetime: every block goes to the current arena until the first free
+ *    of one of its blocks, after which allocations open a new arena. An
+ *    arena is reset, with no per-block frees, once all its blocks are dead.
+ *    The trace must not have reallocs. If ranges is not NULL, check the blocks like eval_mm_valid does.
+ *    Returns the largest total payload seen, or -1 on an error.
+ */
+static int arena_replay(trace_t *trace, int tracenum, range_t **ranges)
+{
+    int i, k, index, size;
+    int total_size = 0, max_total_size = 0;
+    int cur = -1, nslots = 0, nidle = 0;
+    int n = trace->num_ids + 1;
+    arena_t **pool;   /* arena of each slot */
+    int *live;        /* live blocks in each slot */
+    int *idle;        /* stack of reset slots */
+    int *owner;       /* slot of each block */
+    char *p;
+
+    pool = (arena_t **)malloc(n * sizeof(arena_t *));
+    live = (int *)calloc(n, sizeof(int));
+    idle = (int *)malloc(n * sizeof(int));
+    owner = (int *)malloc(n * sizeof(int));
+    if (pool == NULL || live == NULL || idle == NULL || owner == NULL)
+	unix_error("malloc in arena_replay failed");
+
+    mem_reset_brk();
+    if (ranges != NULL)
+	clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return -1;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	k = -1;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* arena_alloc */
+	    if (cur < 0) {
+		if (nidle > 0)
+		    cur = idle[--nidle];
+		else if ((pool[cur = nslots++] = arena_create(0)) == NULL) {
+		    malloc_error(tracenum, i, "arena_create failed.");
+		    return -1;
+		}
+	    }
+	    if ((p = arena_alloc(pool[cur], size)) == NULL) {
+		malloc_error(tracenum, i, "arena_alloc failed.");
+		return -1;
+	    }
+	    if (ranges != NULL) {
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return -1;
+		memset(p, index & 0xFF, size);
+	    }
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    owner[index] = cur;
+	    live[cur]++;
+	    total_size += size;
+	    break;
+
+	case FREE: /* nothing until the whole arena is dead */
+	    if (ranges != NULL)
+		remove_range(ranges, trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    k = owner[index];
+	    if (k == cur)
+		cur = -1;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in arena_replay");
+	}
+
+	if (k >= 0 && --live[k] == 0 && k != cur) {
+	    arena_reset(pool[k]);
+	    idle[nidle++] = k;
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+    }
+
+    for (k = 0; k < nslots; k++)
+	arena_destroy(pool[k]);
+    free(pool);
+    free(live);
+    free(idle);
+    free(owner);
+    return max_total_size;
+}
+
+/*
+ * eval_arena_valid - Check the arenas for correctness and compute the
+ *    space utilization. Traces with reallocs are skipped, as an arena
+ *    can neither grow nor shrink a block.
+ */
+static int eval_arena_valid(trace_t *trace, int tracenum, range_t **ranges,
+			    double *util)
+{
+    int i, max_total_size;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type == REALLOC) {
+	    printf("Trace %d has reallocs, skipped for arenas\n", tracenum);
+	    return 0;
+	}
+	if (trace->ops[i].align) {
+	    printf("Trace %d has aligned requests, skipped for arenas\n", 
+		   tracenum);
+	    return 0;
+	}
+    }
+    if ((max_total_size = arena_replay(trace, tracenum, ranges)) < 0)
+	return 0;
+    *util = (double)max_total_size / (double)mem_peak_heapsize();
+    return 1;
+}
+
+/*
+ * eval_arena_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the arenas.
+ */
+static void eval_arena_speed(void *ptr)
+{
+    if (arena_replay(((speed_t *)ptr)->trace, 0, NULL) < 0)
+	app_error("arena_replay failed in eval_arena_speed");
+}
+
+/*
+ * snap_peak - the number of requests of a trace up to and including
+ *    the one after which the most payload bytes are live
+ */
+static int snap_peak(trace_t *trace)
+{
+    int i, index, total = 0, max_total = 0, peak = 0;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total -= trace->block_sizes[index];
+	    break;
+	}
+	if (total > max_total) {
+	    max_total = total;
+	    peak = i + 1;
+	}
+    }
+    return peak;
+}
+
+/*
+ * snap_build - Replay the first nops requests of a trace on a new mm
+ *    heap, filling each block with the low byte of its id. Returns 0 if
+ *    an allocation failed.
+ */
+static int snap_build(trace_t *trace, int nops)
+{
+    int i, index, size;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	return 0;
+    for (i = 0; i < nops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = trace->ops[i].align ? mm_memalign(trace->ops[i].align, size)
+		 : mm_malloc(size)) == NULL)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    break;
+	}
+    }
+    return 1;
+}
+
+/*
+ * eval_snap_valid - Build a trace's heap up to its peak, save it, wipe
+ *    the arena and restore it. Every live block must come back in place
+ *    with its contents, and the rest of the trace must then run on it.
+ */
+static int eval_snap_valid(trace_t *trace, int tracenum, int nops)
+{
+    int i, j, index, size;
+    char *p;
+
+    for (i = 0; i < trace->num_ids; i++)
+	trace->blocks[i] = NULL;
+    if (!snap_build(trace, nops)) {
+	malloc_error(tracenum, 0, "mm_malloc failed building the heap.");
+	return 0;
+    }
+    if (mem_snapshot(snapfile) < 0) {
+	malloc_error(tracenum, nops, "mem_snapshot failed.");
+	return 0;
+    }
+    mem_reset_brk();
+    if (mem_restore(snapfile) < 0 || mm_attach() < 0) {
+	malloc_error(tracenum, nops, "mem_restore failed.");
+	return 0;
+    }
+
+    for (i = 0; i < trace->num_ids; i++) {
+	if ((p = trace->blocks[i]) == NULL)
+	    continue;
+	for (j = 0; j < (int)trace->block_sizes[i]; j++) {
+	    if ((unsigned char)p[j] != (i & 0xFF)) {
+		malloc_error(tracenum, nops, "mem_restore did not bring "
+			     "back the data of a block");
+		return 0;
+	    }
+	}
+    }
+
+    for (i = nops; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = trace->ops[i].align ? mm_memalign(trace->ops[i].align, size)
+		 : mm_malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "mm_malloc failed on the restored heap.");
+		return 0;
+	    }
+	    trace->blocks[index] = p;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed on the restored heap.");
+		return 0;
+	    }
+	    trace->blocks[index] = p;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+    }
+
+    /* leave the peak heap in the arena for the timings */
+    if (mem_restore(snapfile) < 0 || mm_attach() < 0) {
+	malloc_error(tracenum, nops, "mem_restore failed.");
+	return 0;
+    }
+    return 1;
+}
+
+/*
+ * eval_snap_build - This is the function that is used by fcyc() to
+ *    measure the time to build a trace's peak heap by replaying it.
+ */
+static void eval_snap_build(void *ptr)
+{
+    speed_t *params = (speed_t *)ptr;
+
+    if (!snap_build(params->trace, params->nops))
+	app_error("mm_malloc error in eval_snap_build");
+}
+
+/*
+ * eval_snap_save - This is the function that is used by fcyc() to
+ *    measure the time mem_snapshot takes to save the peak heap.
+ */
+static void eval_snap_save(void *ptr)
+{
+    if (mem_snapshot(snapfile) < 0)
+	app_error("mem_snapshot error in eval_snap_save");
+}
+
+/*
+ * eval_snap_restore - This is the function that is used by fcyc() to
+ *    measure the time to bring the peak heap back. The heap pages are
+ *    mapped from the file lazily, so every one of them is touched.
+ */
+static void eval_snap_restore(void *ptr)
+{
+    static volatile char sink;
+    char *p, *hi;
+
+    if (mem_restore(snapfile) < 0 || mm_attach() < 0)
+	app_error("mem_restore error in eval_snap_restore");
+    hi = mem_heap_hi();
+    for (p = mem_heap_lo(); p <= hi; p += mem_pagesize())
+	sink += *p;
+}
+
+#ifdef MM_THREADS
+/*
+ * replay_trace - Replay a trace against the mm package from one of
+ *    several threads, keeping this thread's own array of blocks. A
+ *    thread with an arena of its own starts a fresh mm heap there.
+ */
+static void *replay_trace(void *ptr)
+{
+    int i, index;
+    char **blocks;
+    trace_t *trace = ((replay_t *)ptr)->trace;
+    int arena = ((replay_t *)ptr)->arena;
+
+    if (arena >= 0) {
+	mem_arena_select(arena);
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in replay_trace");
+    }
+
+    if ((blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc failed in replay_trace");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((blocks[index] = trace->ops[i].align ?
+		 mm_memalign(trace->ops[i].align, trace->ops[i].size) :
+		 mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in replay_trace");
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((blocks[index] = mm_realloc(blocks[index], 
+					    trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in replay_trace");
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_trace");
+        }
+    }
+
+    free(blocks);
+    return NULL;
+}
+
+/*
+ * eval_mm_mt_speed - This is the function that is used by fcyc()
+ *    to measure the running time of nthreads threads replaying the
+ *    same trace at once, either against a single mm heap or each
+ *    against its own arena.
+ */
+static void eval_mm_mt_speed(void *ptr)
+{
+    int i;
+    pthread_t tid[MAXTHREADS];
+    replay_t jobs[MAXTHREADS];
+    speed_t *params = (speed_t *)ptr;
+
+    /* Reset the shared heap and initialize the mm package */
+    if (params->arenas == NULL) {
+	mem_reset_brk();
+	if (mm_init() < 0) 
+	    app_error("mm_init failed in eval_mm_mt_speed");
+    }
+
+    for (i = 0;  i < params->nthreads;  i++) {
+	jobs[i].trace = params->trace;
+	jobs[i].arena = params->arenas ? params->arenas[i] : -1;
+	if (pthread_create(&tid[i], NULL, replay_trace, &jobs[i]) != 0)
+	    unix_error("pthread_create failed in eval_mm_mt_speed");
+    }
+    for (i = 0;  i < params->nthreads;  i++)
+	pthread_join(tid[i], NULL);
+}
+#endif
+
+/*
+ * libc_alloc - Serve an ALLOC request with malloc, or with posix_memalign
+ *    if the request is aligned
+ */
+static void *libc_alloc(traceop_t *op)
+{
+    void *p;
+
+    if (op->align == 0)
+	return malloc(op->size);
+    if (posix_memalign(&p, op->align, op->size) != 0)
+	return NULL;
+    return p;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = libc_alloc(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -877,7 +2309,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -885,8 +2317,7 @@ static void eval_libc_speed(void *ptr)
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
 	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = libc_alloc(&trace->ops[i])) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -926,17 +2357,22 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%9s%9s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "peak KB", "end KB");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].peak)
+		printf("%9.0f%9.0f\n", stats[i].peak/1024.0, 
+		       stats[i].final/1024.0);
+	    else
+		printf("%9s%9s\n", "-", "-");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -972,6 +2408,27 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printsnap - print the heap snapshot times of each trace (-w)
+ */
+static void printsnap(int n, snap_stats_t *stats)
+{
+    int i;
+
+    printf("%5s%7s%9s%11s%11s%11s%8s\n", 
+	   "trace", " valid", "heap KB", "build", "save", "restore", "ratio");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("%2d%10s%9.0f%11.6f%11.6f%11.6f%7.1fx\n", 
+		   i, "yes", stats[i].heap/1024.0, stats[i].build,
+		   stats[i].save, stats[i].restore,
+		   stats[i].build/stats[i].restore);
+	else
+	    printf("%2d%10s%9s%11s%11s%11s%8s\n", 
+		   i, "no", "-", "-", "-", "-", "-");
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -999,19 +2456,84 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printcompare - print the utilization and throughput of m allocators
+ *    side by side, one column pair per allocator
+ */
+static void printcompare(int n, int m, char **names, stats_t **stats)
+{
+    int i, j;
+    double util, ops, secs;
+
+    printf("%5s", "trace");
+    for (j=0; j < m; j++)
+	printf("%14s", names[j]);
+    printf("\n%5s", "");
+    for (j=0; j < m; j++)
+	printf("%6s%8s", "util", "Kops");
+    printf("\n");
+
+    for (i=0; i < n; i++) {
+	printf("%5d", i);
+	for (j=0; j < m; j++) {
+	    if (!stats[j][i].valid)
+		printf("%6s%8s", "-", "-");
+	    else if (stats[j][i].peak == 0)   /* no util for libc */
+		printf("%6s%8.0f", "-", (stats[j][i].ops/1e3)/stats[j][i].secs);
+	    else
+		printf("%5.0f%%%8.0f", stats[j][i].util*100.0,
+		       (stats[j][i].ops/1e3)/stats[j][i].secs);
+	}
+	printf("\n");
+    }
+
+    printf("%5s", "Total");
+    for (j=0; j < m; j++) {
+	util = ops = secs = 0;
+	for (i=0; i < n; i++) {
+	    if (stats[j][i].valid) {
+		util += stats[j][i].util;
+		ops += stats[j][i].ops;
+		secs += stats[j][i].secs;
+	    }
+	}
+	if (stats[j][0].peak == 0)
+	    printf("%6s%8.0f", "-", (ops/1e3)/secs);
+	else
+	    printf("%5.0f%%%8.0f", (util/n)*100.0, (ops/1e3)/secs);
+    }
+    printf("\n");
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValcszwBRMH] [-f <file>] [-t <dir>] [-T <n>] [-A <n>] [-r <n>]\n");
+    fprintf(stderr, "               [-F <fit>] [-S <split>] [-m <impl>] [-C <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <n>     Also time n threads in n separate arenas (mdriver-mt).\n");
+    fprintf(stderr, "\t-c         Compare all mm implementations and libc side by side.\n");
+    fprintf(stderr, "\t-C <n>     Also replay through handles, compacting n bytes per free.\n");
+    fprintf(stderr, "\t-B         Also replay runs of requests with the batch calls.\n");
+    fprintf(stderr, "\t-s         Also replay with mm_malloc_class and mm_free_sized.\n");
+    fprintf(stderr, "\t-w         Also time saving each heap at its peak and restoring it.\n");
+    fprintf(stderr, "\t-z         Also replay with mm_calloc, and with mm_malloc and memset.\n");
+    fprintf(stderr, "\t-R         Also replay in arenas freed a group at a time.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <fit>   Fit policy: best, first, next or good[:k].\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Like -M, using transparent huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <impl>  Test this mm implementation: seg (mm.c), tlsf or buddy.\n");
+    fprintf(stderr, "\t-M         Reserve heaps with mmap and commit pages as they grow.\n");
+    fprintf(stderr, "\t-r <n>[:<max>] Reserve n%% (at most max bytes) after blocks realloc keeps growing.\n");
+    fprintf(stderr, "\t-S <split> Carve blocks from the front, back, back from <n> bytes, or adaptive.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also time n threads replaying each trace (mdriver-mt).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
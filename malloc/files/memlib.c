@@ -2,11 +2,45 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The memory system is a set of independent arenas, each a simulated heap
+ * with its own brk. mem_init creates arena 0. Each thread works on the
+ * arena it last selected with mem_arena_select (arena 0 by default), and
+ * all the mem_* heap routines below act on that arena.
+ *
+ * Arenas come from one of two backends, chosen with mem_set_backend for
+ * the arenas created after the call. MEM_MALLOC mallocs all MAX_HEAP bytes
+ * up front. MEM_MMAP only reserves MMAP_HEAP bytes of address space with
+ * PROT_NONE and commits pages as the brk grows; a negative mem_sbrk
+ * increment hands the pages above the new brk back with MADV_DONTNEED,
+ * so pages past the brk always read as zero when committed again.
+ * MEM_HUGEPAGE is MEM_MMAP on a huge-page aligned range, committed in
+ * huge-page steps and marked MADV_HUGEPAGE.
+ *
+ * Each arena keeps a zero mark: no brk has passed it since the memory
+ * above it was last zeroed, so mem_sbrk hands out zero bytes as long as
+ * the old brk is at or above mem_zero_lo. A MEM_MALLOC arena is calloc'd
+ * and never zeroed again, so its mark only rises; an mmap-backed one
+ * lowers it whenever it gives pages back.
+ *
+ * Besides its brk, an arena owns the separate mappings made with
+ * mem_map. Each mapping starts with a MAP_HDR byte node linking it into
+ * its arena's list, so it can be resized, released and recognized by
+ * address; mem_reset_brk unmaps them all.
+ *
+ * mem_snapshot saves an mmap-backed arena, its heap and its mappings, to
+ * a file, and mem_restore puts them back in place of the current arena
+ * at the same addresses, so that pointers stored in the heap stay valid.
+ * The heap pages are mapped from the file copy-on-write and only read
+ * in when touched; pages the heap later gives back revert to the file
+ * rather than to zero, which the zero mark accounts for.
  */
+#define _GNU_SOURCE           /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
@@ -14,24 +48,78 @@
 #include "memlib.h"
 #include "config.h"
 
+#define HUGE_PAGE (2*(1<<20))  /* commit unit of MEM_HUGEPAGE arenas */
+#define MAP_HDR 32             /* bytes in front of a mem_map area */
+#define SNAP_MAGIC "memsnap"   /* first bytes of a mem_snapshot file */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0  /* then the address is only a hint */
+#endif
+
+/* the header of a mem_map mapping */
+typedef struct map_t {
+    struct map_t *next;
+    struct map_t *prev;
+    size_t len;       /* length of the whole mapping */
+} map_t;
+
+/* a simulated heap */
+typedef struct {
+    char *start_brk;  /* points to first byte of heap */
+    char *brk;        /* points to last byte of heap */
+    char *max_addr;   /* largest legal heap address */ 
+    char *zero_lo;    /* everything from here up reads as zero */
+    char *file_end;   /* end of the pages mapped from a snapshot file */
+    int backend;      /* MEM_MALLOC, MEM_MMAP or MEM_HUGEPAGE */
+    char *commit;     /* end of the committed pages (mmap backends) */
+    void *map_base;   /* the whole reserved mapping (mmap backends) */
+    size_t map_len;
+    map_t *maps;      /* mappings made with mem_map */
+    size_t mapped;    /* their total length */
+    size_t peak;      /* peak of heap size plus mapped bytes */
+} arena_t;
+
+/* the first page of a snapshot file, followed by the heap pages, a
+   table of the mem_map areas and then their pages */
+typedef struct {
+    char magic[8];    /* SNAP_MAGIC */
+    char *start_brk;  /* heap base the arena was saved from */
+    size_t heapsize;  /* bytes from the base to the brk */
+    int backend;      /* MEM_MMAP or MEM_HUGEPAGE */
+    size_t pagesize;  /* page size of the saving host */
+    size_t nmaps;     /* number of mem_map areas saved */
+} snap_t;
+
+/* a mem_map area in a snapshot file */
+typedef struct {
+    void *addr;       /* address of its map_t node */
+    size_t len;
+} snap_map_t;
+
+static int arena_setup(arena_t *a, int b);
+static void arena_free(arena_t *a);
+static int mem_commit(arena_t *a, char *new_brk);
+static int full_io(int fd, void *buf, size_t n, off_t off, int wr);
+static int snap_place(arena_t *a, snap_t *h, int fd);
+static void map_link(arena_t *a, map_t *m);
+static void map_unlink(arena_t *a, map_t *m);
+static void note_peak(arena_t *a);
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static int backend = MEM_MALLOC;    /* backend of arenas created next */
+static arena_t arenas[MAX_ARENAS];  /* all arenas created so far */
+static int num_arenas;              /* number of arenas in use */
+static __thread arena_t *cur = &arenas[0];  /* this thread's arena */
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model with a single arena
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    num_arenas = 0;
+    if (mem_arena_create() < 0)
 	exit(1);
-    }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    cur = &arenas[0];
 }
 
 /* 
@@ -39,7 +127,114 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    for (i = 0; i < num_arenas; i++) {
+	mem_arena_select(i);
+	mem_reset_brk();
+	arena_free(&arenas[i]);
+    }
+    num_arenas = 0;
+    cur = &arenas[0];
+}
+
+/*
+ * mem_set_backend - choose the backend of the arenas created from now
+ *    on, including the one set up by mem_init
+ */
+void mem_set_backend(int b)
+{
+    backend = b;
+}
+
+/*
+ * mem_arena_create - add an empty arena and return its id, or -1 on
+ *    failure. Not thread-safe: create arenas before handing them to
+ *    threads.
+ */
+int mem_arena_create(void)
+{
+    arena_t *a;
+
+    if (num_arenas == MAX_ARENAS) {
+	fprintf(stderr, "mem_arena_create: too many arenas\n");
+	return -1;
+    }
+    a = &arenas[num_arenas];
+    if (arena_setup(a, backend) < 0)
+	return -1;
+    return num_arenas++;
+}
+
+/*
+ * arena_setup - set up empty storage of backend b for arena a
+ */
+static int arena_setup(arena_t *a, int b)
+{
+    a->backend = b;
+
+    if (b == MEM_MALLOC) {
+	/* allocate the storage we will use to model the available VM */
+	if ((a->start_brk = (char *)calloc(1, MAX_HEAP)) == NULL) {
+	    fprintf(stderr, "mem_init_vm: malloc error\n");
+	    return -1;
+	}
+	a->max_addr = a->start_brk + MAX_HEAP;  /* max legal heap address */
+    }
+    else {
+	/* only reserve the address space, aligned to the commit unit */
+	size_t align = (b == MEM_HUGEPAGE) ? HUGE_PAGE : mem_pagesize();
+	a->map_len = MMAP_HEAP + align;
+	a->map_base = mmap(NULL, a->map_len, PROT_NONE, 
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (a->map_base == MAP_FAILED) {
+	    fprintf(stderr, "mem_init_vm: mmap error: %s\n", strerror(errno));
+	    return -1;
+	}
+	a->start_brk = (char *)(((size_t)a->map_base + align - 1) & ~(align - 1));
+	a->max_addr = a->start_brk + MMAP_HEAP;
+	a->commit = a->start_brk;
+#ifdef MADV_HUGEPAGE
+	if (b == MEM_HUGEPAGE)
+	    madvise(a->start_brk, MMAP_HEAP, MADV_HUGEPAGE);
+#endif
+    }
+
+    a->brk = a->start_brk;                  /* heap is empty initially */
+    a->zero_lo = a->start_brk;
+    a->file_end = a->start_brk;
+    a->maps = NULL;
+    a->mapped = 0;
+    a->peak = 0;
+    return 0;
+}
+
+/*
+ * arena_free - release the storage of arena a, whose mappings are gone
+ */
+static void arena_free(arena_t *a)
+{
+    if (a->backend == MEM_MALLOC)
+	free(a->start_brk);
+    else
+	munmap(a->map_base, a->map_len);
+}
+
+/*
+ * mem_arena_select - make arena id the calling thread's current arena
+ */
+void mem_arena_select(int id)
+{
+    assert(id >= 0 && id < num_arenas);
+    cur = &arenas[id];
+}
+
+/*
+ * mem_arena_current - return the id of the calling thread's arena
+ */
+int mem_arena_current(void)
+{
+    return (int)(cur - arenas);
 }
 
 /*
@@ -47,33 +242,391 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    if (cur->backend != MEM_MALLOC)
+	mem_commit(cur, cur->start_brk);
+    cur->brk = cur->start_brk;
+    while (cur->maps != NULL)
+	mem_unmap((char *)cur->maps + MAP_HDR);
+    cur->peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap; mmap-backed heaps then give the
+ *    pages back to the kernel.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = cur->brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (incr < 0 && cur->brk + incr < cur->start_brk) ||
+	 ((cur->brk + incr) > cur->max_addr) ||
+	 (cur->backend != MEM_MALLOC && mem_commit(cur, cur->brk + incr) < 0)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    cur->brk += incr;
+    if (cur->brk > cur->zero_lo)
+	cur->zero_lo = cur->brk;
+    note_peak(cur);
     return (void *)old_brk;
 }
 
+/*
+ * mem_commit - move the end of an mmap-backed arena's committed pages
+ *    to the first commit unit boundary at or above new_brk, making new
+ *    pages accessible as the heap grows and releasing them to the
+ *    kernel as it shrinks
+ */
+static int mem_commit(arena_t *a, char *new_brk)
+{
+    size_t unit = (a->backend == MEM_HUGEPAGE) ? HUGE_PAGE : mem_pagesize();
+    char *end = a->start_brk + 
+	((size_t)(new_brk - a->start_brk) + unit - 1) / unit * unit;
+
+    if (end > a->commit) {
+	if (mprotect(a->commit, end - a->commit, PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+    }
+    else if (end < a->commit) {
+	madvise(end, a->commit - end, MADV_DONTNEED);
+	mprotect(end, a->commit - end, PROT_NONE);
+	/* dropped pages read as zero again, unless they come from a file */
+	if (a->zero_lo > end)
+	    a->zero_lo = (end > a->file_end) ? end : 
+		(a->zero_lo < a->file_end) ? a->zero_lo : a->file_end;
+    }
+    a->commit = end;
+    return 0;
+}
+
+/*
+ * mem_map - map a separate area of at least size bytes, owned by the
+ *    current arena. Returns NULL on failure.
+ */
+void *mem_map(size_t size)
+{
+    size_t len = size + MAP_HDR;
+    map_t *m;
+
+    if (len < size)
+	return NULL;
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    m = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED)
+	return NULL;
+    m->len = len;
+    map_link(cur, m);
+    return (char *)m + MAP_HDR;
+}
+
+/*
+ * mem_remap - resize the mem_map area p to at least size bytes, keeping
+ *    its contents and moving it if need be. Returns the new address, or
+ *    NULL with p left intact on failure.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    map_t *m = (map_t *)((char *)p - MAP_HDR);
+    size_t len = size + MAP_HDR;
+    map_t *n;
+
+    if (len < size)
+	return NULL;
+    len = (len + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    map_unlink(cur, m);
+    /* ThreadSanitizer does not follow mremap, so copy under it */
+#if defined(MREMAP_MAYMOVE) && !defined(__SANITIZE_THREAD__)
+    n = mremap(m, m->len, len, MREMAP_MAYMOVE);
+#else
+    n = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (n != MAP_FAILED) {
+	memcpy(n, m, len < m->len ? len : m->len);
+	munmap(m, m->len);
+    }
+#endif
+    if (n == MAP_FAILED) {
+	map_link(cur, m);
+	return NULL;
+    }
+    n->len = len;
+    map_link(cur, n);
+    return (char *)n + MAP_HDR;
+}
+
+/*
+ * mem_unmap - release the mem_map area p
+ */
+void mem_unmap(void *p)
+{
+    map_t *m = (map_t *)((char *)p - MAP_HDR);
+
+    map_unlink(cur, m);
+    munmap(m, m->len);
+}
+
+/*
+ * mem_snapshot - save the current arena, which must be mmap-backed, to
+ *    the file at path. The file is written aside and renamed into place,
+ *    as the heap may be mapped from the one it replaces. Returns 0, or
+ *    -1 on failure.
+ */
+int mem_snapshot(const char *path)
+{
+    size_t page = mem_pagesize();
+    size_t heap_pages = (mem_heapsize() + page - 1) / page * page;
+    off_t off = page + heap_pages;
+    snap_t h;
+    snap_map_t rec;
+    map_t *m;
+    char *tmp;
+    int fd, ok = 1;
+
+    if (cur->backend == MEM_MALLOC) {
+	fprintf(stderr, "mem_snapshot: the arena must be mmap-backed\n");
+	return -1;
+    }
+    if ((tmp = malloc(strlen(path) + 8)) == NULL)
+	return -1;
+    sprintf(tmp, "%s.XXXXXX", path);
+    if ((fd = mkstemp(tmp)) < 0) {
+	fprintf(stderr, "mem_snapshot: %s: %s\n", tmp, strerror(errno));
+	free(tmp);
+	return -1;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.start_brk = cur->start_brk;
+    h.heapsize = mem_heapsize();
+    h.backend = cur->backend;
+    h.pagesize = page;
+    for (m = cur->maps; m != NULL; m = m->next)
+	h.nmaps++;
+    ok = full_io(fd, &h, sizeof(h), 0, 1) == 0 &&
+	full_io(fd, cur->start_brk, h.heapsize, page, 1) == 0;
+
+    /* the table of mappings, then each mapping from a page boundary */
+    off += (h.nmaps * sizeof(rec) + page - 1) / page * page;
+    for (m = cur->maps, h.nmaps = 0; ok && m != NULL; m = m->next, h.nmaps++) {
+	rec.addr = m;
+	rec.len = m->len;
+	ok = full_io(fd, &rec, sizeof(rec), 
+		     page + heap_pages + h.nmaps * sizeof(rec), 1) == 0 &&
+	    full_io(fd, m, m->len, off, 1) == 0;
+	off += m->len;
+    }
+    /* the heap's last page must be in the file for mem_restore to map */
+    if (ok)
+	ok = ftruncate(fd, off) == 0;
+    if (close(fd) < 0 || !ok || rename(tmp, path) < 0) {
+	fprintf(stderr, "mem_snapshot: %s: %s\n", path, strerror(errno));
+	unlink(tmp);
+	ok = 0;
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * mem_restore - replace the current arena with the one saved in path,
+ *    at the addresses it was saved from. Returns 0, or -1 if the file
+ *    is not a snapshot or its addresses are taken, in which case the
+ *    arena is left empty.
+ */
+int mem_restore(const char *path)
+{
+    snap_t h;
+    int fd, rc, backend = cur->backend;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	fprintf(stderr, "mem_restore: %s: %s\n", path, strerror(errno));
+	return -1;
+    }
+    if (full_io(fd, &h, sizeof(h), 0, 0) < 0 || 
+	memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) != 0 ||
+	h.pagesize != mem_pagesize() || h.heapsize > MMAP_HEAP) {
+	fprintf(stderr, "mem_restore: %s is not a snapshot of this host\n", path);
+	close(fd);
+	return -1;
+    }
+
+    /* the old arena makes way, as it may hold the same addresses */
+    mem_reset_brk();
+    arena_free(cur);
+    if ((rc = snap_place(cur, &h, fd)) < 0) {
+	while (cur->maps != NULL)
+	    mem_unmap((char *)cur->maps + MAP_HDR);
+	if (cur->map_base != NULL)
+	    munmap(cur->map_base, cur->map_len);
+	if (arena_setup(cur, backend) < 0)
+	    exit(1);
+    }
+    close(fd);
+    return rc;
+}
+
+/*
+ * snap_place - rebuild arena a from the snapshot file fd with header h:
+ *    reserve its address range, map the heap pages from the file and
+ *    read the mappings back. On failure a->map_base is NULL, or set to
+ *    what has been reserved.
+ */
+static int snap_place(arena_t *a, snap_t *h, int fd)
+{
+    size_t page = h->pagesize;
+    size_t heap_pages = (h->heapsize + page - 1) / page * page;
+    off_t off = page + heap_pages;
+    snap_map_t rec;
+    map_t *m;
+    size_t i;
+    void *p;
+
+    a->backend = h->backend;
+    a->maps = NULL;
+    a->mapped = 0;
+    a->map_base = NULL;
+    a->map_len = MMAP_HEAP;
+    p = mmap(h->start_brk, a->map_len, PROT_NONE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p == MAP_FAILED || p != h->start_brk) {
+	/* kernels without MAP_FIXED_NOREPLACE take it as a hint */
+	if (p != MAP_FAILED)
+	    munmap(p, a->map_len);
+	fprintf(stderr, "mem_restore: heap address %p is taken\n", 
+		(void *)h->start_brk);
+	return -1;
+    }
+    a->map_base = p;
+    a->start_brk = h->start_brk;
+    a->max_addr = a->start_brk + MMAP_HEAP;
+    if (heap_pages != 0 &&
+	mmap(a->start_brk, heap_pages, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_FIXED, fd, page) == MAP_FAILED) {
+	fprintf(stderr, "mem_restore: mmap error: %s\n", strerror(errno));
+	return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if (a->backend == MEM_HUGEPAGE)
+	madvise(a->start_brk, MMAP_HEAP, MADV_HUGEPAGE);
+#endif
+    a->commit = a->file_end = a->zero_lo = a->start_brk + heap_pages;
+    a->brk = a->start_brk + h->heapsize;
+    if (mem_commit(a, a->brk) < 0)
+	return -1;
+
+    off += (h->nmaps * sizeof(rec) + page - 1) / page * page;
+    for (i = 0; i < h->nmaps; i++) {
+	if (full_io(fd, &rec, sizeof(rec), 
+		    page + heap_pages + i * sizeof(rec), 0) < 0)
+	    return -1;
+	m = mmap(rec.addr, rec.len, PROT_READ | PROT_WRITE, 
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (m == MAP_FAILED || (void *)m != rec.addr) {
+	    if (m != MAP_FAILED)
+		munmap(m, rec.len);
+	    fprintf(stderr, "mem_restore: mapping address %p is taken\n", 
+		    rec.addr);
+	    return -1;
+	}
+	if (full_io(fd, m, rec.len, off, 0) < 0) {
+	    munmap(m, rec.len);
+	    return -1;
+	}
+	m->len = rec.len;
+	map_link(a, m);
+	off += rec.len;
+    }
+    a->peak = 0;
+    note_peak(a);
+    return 0;
+}
+
+/*
+ * full_io - read (wr == 0) or write n bytes at offset off of fd, going
+ *    on after short transfers. Returns 0, or -1 on failure.
+ */
+static int full_io(int fd, void *buf, size_t n, off_t off, int wr)
+{
+    char *p = buf;
+    ssize_t done;
+
+    while (n > 0) {
+	done = wr ? pwrite(fd, p, n, off) : pread(fd, p, n, off);
+	if (done < 0 && errno == EINTR)
+	    continue;
+	if (done <= 0)
+	    return -1;
+	p += done;
+	off += done;
+	n -= done;
+    }
+    return 0;
+}
+
+/*
+ * mem_is_mapped - is [lo, hi] inside one of the current arena's
+ *    mem_map areas?
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    map_t *m;
+
+    for (m = cur->maps; m != NULL; m = m->next)
+	if ((char *)lo >= (char *)m + MAP_HDR && (char *)hi < (char *)m + m->len)
+	    return 1;
+    return 0;
+}
+
+/*
+ * map_link - add mapping m to arena a
+ */
+static void map_link(arena_t *a, map_t *m)
+{
+    m->prev = NULL;
+    m->next = a->maps;
+    if (a->maps != NULL)
+	a->maps->prev = m;
+    a->maps = m;
+    a->mapped += m->len;
+    note_peak(a);
+}
+
+/*
+ * map_unlink - take mapping m out of arena a
+ */
+static void map_unlink(arena_t *a, map_t *m)
+{
+    if (m->prev != NULL)
+	m->prev->next = m->next;
+    else
+	a->maps = m->next;
+    if (m->next != NULL)
+	m->next->prev = m->prev;
+    a->mapped -= m->len;
+}
+
+/*
+ * note_peak - record the current footprint of arena a if it is the
+ *    largest so far
+ */
+static void note_peak(arena_t *a)
+{
+    size_t size = (size_t)(a->brk - a->start_brk) + a->mapped;
+
+    if (size > a->peak)
+	a->peak = size;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return (void *)cur->start_brk;
 }
 
 /* 
@@ -81,7 +634,16 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(cur->brk - 1);
+}
+
+/*
+ * mem_zero_lo - return the lowest address from which the heap and the
+ *    space past its brk are known to read as zero
+ */
+void *mem_zero_lo()
+{
+    return (void *)cur->zero_lo;
 }
 
 /*
@@ -89,7 +651,24 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(cur->brk - cur->start_brk);
+}
+
+/*
+ * mem_mapsize() - returns the bytes held in mem_map areas
+ */
+size_t mem_mapsize() 
+{
+    return cur->mapped;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size plus mapped bytes
+ *    since the heap was last reset
+ */
+size_t mem_peak_heapsize() 
+{
+    return cur->peak;
 }
 
 /*
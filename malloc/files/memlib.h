@@ -1,11 +1,29 @@
 #include <unistd.h>
 
+/* memlib backends (mem_set_backend) */
+#define MEM_MALLOC   0  /* all of MAX_HEAP malloc'd up front (default) */
+#define MEM_MMAP     1  /* reserved with mmap, committed as the brk grows */
+#define MEM_HUGEPAGE 2  /* MEM_MMAP using transparent huge pages */
+
 void mem_init(void);               
 void mem_deinit(void);
+void mem_set_backend(int backend);
+int mem_arena_create(void);
+void mem_arena_select(int id);
+int mem_arena_current(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void *mem_map(size_t size);
+void *mem_remap(void *p, size_t size);
+void mem_unmap(void *p);
+int mem_is_mapped(void *lo, void *hi);
+int mem_snapshot(const char *path);
+int mem_restore(const char *path);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_zero_lo(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
@@ -1,9 +1,50 @@
 #include <stdio.h>
 
 extern int mm_init (void);
+extern int mm_attach(void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void mm_set_slack(int percent, size_t max);
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_malloc_class(int cls);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+
+/* relocatable blocks: mm_compact moves a handle's block while it is not
+   pinned (0 is no handle) */
+typedef unsigned int mm_handle_t;
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hpin(mm_handle_t h);
+extern void mm_hunpin(mm_handle_t h);
+extern int mm_hrealloc(mm_handle_t h, size_t size);
+extern void mm_hfree(mm_handle_t h);
+extern int mm_compact(size_t budget);
+
+/* request classes for mm_malloc_class: class c holds 8*c bytes */
+#define MM_CLASSES 32
+#define MM_CLASS(size) (((size) + 7) / 8)  /* class of a 1..256 byte request */
+#define MM_CLASS_SIZE(cls) ((size_t)(cls) * 8)
+
+/* fit policies (mm_set_fit) */
+#define MM_BEST_FIT  0  /* smallest fitting block (default) */
+#define MM_FIRST_FIT 1  /* first fitting block met in the class index */
+#define MM_GOOD_FIT  2  /* smallest of the first k fitting blocks met */
+#define MM_NEXT_FIT  3  /* first fit in address order from a roving pointer */
+
+/* split rules (mm_set_split): which end of a free block to carve from */
+#define MM_SPLIT_SIZE  0  /* the back for blocks of threshold bytes and up */
+#define MM_SPLIT_FRONT 1  /* always the front */
+#define MM_SPLIT_BACK  2  /* always the back */
+#define MM_SPLIT_ADAPTIVE 3  /* a threshold learned from block sizes and
+				lifetimes, starting at the given one (default,
+				starting at 96) */
+
+extern void mm_set_fit(int policy, int k);
+extern void mm_set_split(int rule, size_t threshold);
 
 
 /* 
@@ -0,0 +1,310 @@
+/*
+ * tlsf.c - A two-level segregated fit (TLSF) implementation of the mm
+ * interface, with malloc and free in constant time.
+ *
+ * Free blocks are kept in SL_COUNT lists per power of two (the first
+ * level), each covering an equal slice of it (the second level); blocks
+ * below SMALL_BLOCK bytes share first level 0 in 8-byte steps. A bitmap of
+ * non-empty first levels and one bitmap of non-empty lists per first level
+ * find the first list whose every block fits with two find-first-set
+ * instructions, so no list is ever walked. A request is rounded up to the
+ * next list boundary before the search, and the head of the list found is
+ * taken: good fit rather than best fit, but with no search.
+ *
+ * Blocks use the same layout as mm.c: a header with the size, bit 0 set
+ * if the block is allocated and bit 1 set if the previous block is, a
+ * footer only on free blocks, and free list links stored as 32-bit offsets
+ * from the heap base. Free blocks are coalesced at once, in constant time.
+ *
+ * The list heads and bitmaps live in a root struct at the start of the
+ * heap. Only growing the heap (mem_sbrk) is not bounded, which happens
+ * CHUNKSIZE bytes at a time at least. The package is not thread-safe.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "tlsf.h"
+#include "memlib.h"
+
+#define ALIGNMENT	8
+#define ALIGN(size)	(((size) + (ALIGNMENT-1)) & ~0x7)
+
+#define WSIZE	4
+#define DSIZE	8
+#define CHUNKSIZE	(1<<12)
+
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+#define PACK(size, alloc) ((unsigned int)(size) | (alloc))
+#define PREV_ALLOC	0x2
+
+#define GET(p)	(*(unsigned int *)(p))
+#define PUT(p, val)	(*(unsigned int *)(p) = (val))
+
+#define GET_SIZE(p) (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+// block size for a payload of size bytes: header, alignment, room for a free block
+#define ADJUST(size)	((size) <= DSIZE+WSIZE ? 2*DSIZE : ALIGN((size) + WSIZE))
+
+#define HDRP(bp)	((char *)(bp) - WSIZE)
+#define FTRP(bp)	((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+#define NEXT_BLKP(bp)	((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp)	((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+
+#define SET_NEXT_PALLOC(bp)	(GET(HDRP(NEXT_BLKP(bp))) |= PREV_ALLOC)
+#define CLR_NEXT_PALLOC(bp)	(GET(HDRP(NEXT_BLKP(bp))) &= ~PREV_ALLOC)
+
+// free list links are offsets from the heap base, 0 being the null link
+#define TO_OFF(bp)	((bp) ? (unsigned int)((char *)(bp) - heap_lo) : 0)
+#define TO_PTR(off)	((off) ? heap_lo + (off) : NULL)
+#define NEXT_FREE(bp)	TO_PTR(GET(bp))
+#define PREV_FREE(bp)	TO_PTR(GET((char*)(bp) + WSIZE))
+#define SET_NEXT(bp, p)	PUT(bp, TO_OFF(p))
+#define SET_PREV(bp, p)	PUT((char *)(bp) + WSIZE, TO_OFF(p))
+
+// the two levels of the index
+#define SL_LOG2	4
+#define SL_COUNT	(1<<SL_LOG2)	// lists per first level
+#define FL_SHIFT	(SL_LOG2 + 3)
+#define SMALL_BLOCK	(1<<FL_SHIFT)	// blocks below this share first level 0
+#define FL_COUNT	(32 - FL_SHIFT + 1)
+// largest request: rounding it up to a list boundary must not overflow
+#define TLSF_MAX	((size_t)1 << 30)
+
+// allocator state at the start of the heap
+typedef struct {
+	unsigned int fl_map;	// bit f set iff first level f has a non-empty list
+	unsigned int sl_map[FL_COUNT];	// bit s set iff head[f][s] is non-empty
+	unsigned int head[FL_COUNT][SL_COUNT];	// free list heads
+} tlsf_root_t;
+
+#define ROOT	((tlsf_root_t *)heap_lo)
+#define ROOT_SIZE	ALIGN(sizeof(tlsf_root_t))
+
+static char *heap_lo;
+
+static void *extend_heap(size_t words);
+static void mapping(size_t size, int *fl, int *sl);
+static void *find_suitable(size_t asize);
+static void insert(char *bp);
+static void remove_free(char *bp);
+static void *coalesce(char *bp);
+static void place(char *bp, size_t asize);
+static void split(char *bp, size_t asize);
+
+/*
+ * tlsf_init - initialize the package on an empty heap.
+ */
+int tlsf_init(void)
+{
+	char *heap_listp;
+	if((heap_lo = mem_sbrk(ROOT_SIZE + 2*DSIZE)) == (void *)-1)
+		return -1;
+	memset(ROOT, 0, ROOT_SIZE);
+	heap_listp = heap_lo + ROOT_SIZE;
+	PUT(heap_listp, 0); //alignment padding
+	PUT(heap_listp + (1*WSIZE), PACK(DSIZE, PREV_ALLOC|1)); //prologue header
+	PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); //prologue footer
+	PUT(heap_listp + (3*WSIZE), PACK(0, PREV_ALLOC|1)); //epilogue header
+	if(extend_heap(CHUNKSIZE/WSIZE) == NULL)
+		return -1;
+	return 0;
+}
+
+// extend_heap - grow the heap by a free block, merged with a free block
+// at the top
+static void *extend_heap(size_t words) {
+	char *bp;
+	size_t size = (words % 2)? (words+1) * WSIZE : words * WSIZE;
+	if(size > INT_MAX)
+		return NULL;
+	if((long)(bp = mem_sbrk(size)) == -1)
+		return NULL;
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), GET(HDRP(bp)));
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+	return coalesce(bp);
+}
+
+/*
+ * tlsf_malloc - Allocate a block of at least size bytes.
+ */
+void *tlsf_malloc(size_t size)
+{
+	size_t asize;
+	char *bp;
+	if(size==0 || size > TLSF_MAX)
+		return NULL;
+	asize = ADJUST(size);
+	if((bp = find_suitable(asize)) == NULL &&
+			(bp = extend_heap(MAX(asize, CHUNKSIZE)/WSIZE)) == NULL)
+		return NULL;
+	remove_free(bp);
+	place(bp, asize);
+	return bp;
+}
+
+/*
+ * tlsf_free - Free a block, coalescing it with its free neighbours.
+ */
+void tlsf_free(void *bp)
+{
+	if(bp == NULL)
+		return;
+	PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), GET(HDRP(bp)));
+	CLR_NEXT_PALLOC(bp);
+	coalesce(bp);
+}
+
+/*
+ * tlsf_realloc - Resize a block in place when it shrinks, when the next
+ *     block is free and large enough, or when it ends the heap; otherwise
+ *     move it.
+ */
+void *tlsf_realloc(void *ptr, size_t size)
+{
+	if(ptr == NULL)
+		return tlsf_malloc(size);
+	if(size == 0) {
+		tlsf_free(ptr);
+		return NULL;
+	}
+	if(size > TLSF_MAX)
+		return NULL;
+	size_t asize = ADJUST(size);
+	size_t oldsize = GET_SIZE(HDRP(ptr));
+	char *next = NEXT_BLKP(ptr);
+	if(asize <= oldsize) {
+		split(ptr, asize);
+		return ptr;
+	}
+	// a block ending the heap grows by the shortfall only
+	size_t nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+	if(oldsize+nsize < asize && GET_SIZE(HDRP(nsize ? NEXT_BLKP(next) : next)) == 0 &&
+			extend_heap(MAX(asize-oldsize-nsize, 2*DSIZE)/WSIZE) != NULL)
+		nsize = GET_SIZE(HDRP(next));
+	if(oldsize+nsize >= asize) {
+		remove_free(next);
+		PUT(HDRP(ptr), PACK(oldsize+nsize, GET_PREV_ALLOC(HDRP(ptr))|1));
+		SET_NEXT_PALLOC(ptr);
+		split(ptr, asize);
+		return ptr;
+	}
+	void *newptr;
+	if((newptr = tlsf_malloc(size)) == NULL)
+		return NULL;
+	memcpy(newptr, ptr, oldsize - WSIZE);
+	tlsf_free(ptr);
+	return newptr;
+}
+
+// first and second level index of the list holding blocks of size bytes
+static void mapping(size_t size, int *fl, int *sl) {
+	if(size < SMALL_BLOCK) {
+		*fl = 0;
+		*sl = size / DSIZE;
+	}
+	else {
+		int b = 31 - __builtin_clz((unsigned int)size);
+		*fl = b - FL_SHIFT + 1;
+		*sl = (int)(size >> (b - SL_LOG2)) - SL_COUNT;
+	}
+}
+
+// head of the first non-empty list whose blocks all hold asize bytes
+static void *find_suitable(size_t asize) {
+	int fl, sl;
+	unsigned int map;
+	// round up to the next list boundary, so any block of the list fits
+	if(asize >= SMALL_BLOCK)
+		asize += ((size_t)1 << (31 - __builtin_clz((unsigned int)asize) - SL_LOG2)) - 1;
+	mapping(asize, &fl, &sl);
+	map = ROOT->sl_map[fl] & (~0u << sl);
+	if(map == 0) {
+		map = ROOT->fl_map & (~0u << (fl+1));
+		if(map == 0)
+			return NULL;
+		fl = __builtin_ctz(map);
+		map = ROOT->sl_map[fl];
+	}
+	sl = __builtin_ctz(map);
+	return TO_PTR(ROOT->head[fl][sl]);
+}
+
+// push the free block bp on its list
+static void insert(char *bp) {
+	int fl, sl;
+	mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	char *head = TO_PTR(ROOT->head[fl][sl]);
+	SET_NEXT(bp, head);
+	SET_PREV(bp, NULL);
+	if(head != NULL)
+		SET_PREV(head, bp);
+	ROOT->head[fl][sl] = TO_OFF(bp);
+	ROOT->fl_map |= 1u << fl;
+	ROOT->sl_map[fl] |= 1u << sl;
+}
+
+// unlink the free block bp from its list
+static void remove_free(char *bp) {
+	int fl, sl;
+	char *next = NEXT_FREE(bp);
+	char *prev = PREV_FREE(bp);
+	mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	if(next != NULL)
+		SET_PREV(next, prev);
+	if(prev != NULL)
+		SET_NEXT(prev, next);
+	else if((ROOT->head[fl][sl] = TO_OFF(next)) == 0) {
+		ROOT->sl_map[fl] &= ~(1u << sl);
+		if(ROOT->sl_map[fl] == 0)
+			ROOT->fl_map &= ~(1u << fl);
+	}
+}
+
+// merge the free block bp with its free neighbours and list the result;
+// free blocks never touch, so the merged block follows an allocated one
+static void *coalesce(char *bp) {
+	size_t size = GET_SIZE(HDRP(bp));
+	char *next = NEXT_BLKP(bp);
+	if(!GET_ALLOC(HDRP(next))) {
+		remove_free(next);
+		size += GET_SIZE(HDRP(next));
+	}
+	if(!GET_PREV_ALLOC(HDRP(bp))) {
+		bp = PREV_BLKP(bp);
+		remove_free(bp);
+		size += GET_SIZE(HDRP(bp));
+	}
+	PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(size, PREV_ALLOC));
+	insert(bp);
+	return bp;
+}
+
+// mark the unlisted free block bp allocated, giving back what asize leaves
+static void place(char *bp, size_t asize) {
+	PUT(HDRP(bp), GET(HDRP(bp)) | 1);
+	SET_NEXT_PALLOC(bp);
+	split(bp, asize);
+}
+
+// shrink the allocated block bp to asize bytes if that frees a block of
+// 16 bytes or more
+static void split(char *bp, size_t asize) {
+	size_t size = GET_SIZE(HDRP(bp));
+	if(size - asize < 2*DSIZE)
+		return;
+	PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp))|1));
+	char *rest = bp + asize;
+	PUT(HDRP(rest), PACK(size - asize, PREV_ALLOC));
+	PUT(FTRP(rest), GET(HDRP(rest)));
+	CLR_NEXT_PALLOC(rest);
+	coalesce(rest);
+}
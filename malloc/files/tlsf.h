@@ -0,0 +1,10 @@
+/*
+ * tlsf.h - the mm interface implemented by two-level segregated fit,
+ * with constant-time malloc and free (mdriver -m tlsf)
+ */
+#include <stddef.h>
+
+extern int tlsf_init(void);
+extern void *tlsf_malloc(size_t size);
+extern void tlsf_free(void *ptr);
+extern void *tlsf_realloc(void *ptr, size_t size);
@@ -9,6 +9,106 @@
  * Organization method for free blocks : segregated free list (implicit free list, explicit free list)
  * Search method for free blocks: best fit (first fit, next fit)
  * Separation method for blocks : keep small free blocks at the front and large free blocks at the end
+ *
+ * Allocated blocks carry only a header; the footer is needed only by
+ * coalesce, so only free blocks have one. Bit 1 of every header records
+ * whether the previous block is allocated, which is all coalesce needs to
+ * know before it looks for the previous block's footer.
+ *
+ * Free list links and the segregated list roots are stored as 32-bit byte
+ * offsets from mem_heap_lo() rather than raw pointers, so a free block
+ * node stays 8 bytes on both 32-bit and 64-bit hosts and the heap can grow
+ * up to 4 GB. Offset 0 is the alignment padding word and never names a
+ * free block, so it doubles as the null link.
+ *
+ * Free blocks are segregated into four size classes per power of two;
+ * the class of a small size is a table lookup.
+ *
+ * Classes of blocks of TREE_MIN_SIZE bytes and up are not kept as sorted
+ * lists but as treaps keyed on (size, address), reusing the two link words
+ * as left/right children. The heap priority is a hash of the block offset,
+ * so insertion, removal and best-fit search take O(log n) expected time
+ * without any extra field in the free block.
+ *
+ * Requests of up to SLAB_MAX bytes are served from slab pages: allocated
+ * blocks of SLAB_PAGE bytes whose payload starts on a SLAB_PAGE boundary,
+ * so adjacent pages tile the heap, cut into equal slots with no
+ * per-object header. A slab
+ * page header holds the slot size, a free count and a bitmap of used
+ * slots. A bitmap directory, itself an ordinary heap block, marks which
+ * aligned pages are slabs, so mm_free tells a slot from a block by address.
+ *
+ * Built with -DMM_THREADS, the package is thread-safe: the heap is guarded
+ * by a single lock, and each thread keeps a cache of small objects per
+ * 8-byte size class in front of it. mm_malloc and mm_free of small objects
+ * only touch the calling thread's cache; a cache refills and flushes
+ * CACHE_BATCH objects at a time under the lock, and is flushed when its
+ * thread exits. mm_init bumps an epoch that invalidates every cache.
+ *
+ * mm_set_fit and mm_set_split pick the placement policy. Small classes
+ * are size-sorted lists, where the first fit is also the best fit, so
+ * the fit policies differ in how far a treap search descends; next fit
+ * instead walks the blocks in address order from a roving pointer.
+ *
+ * place() carves large blocks from the back of a free block and small ones
+ * from the front. By default the size threshold is learned: the heap
+ * counts live blocks and recent allocations per power of two, and every
+ * ADAPT_PERIOD allocations moves the threshold to the power of two that
+ * best keeps long-lived blocks apart from short-lived ones.
+ *
+ * mm_free does not coalesce blocks of up to QUICK_MAX bytes at once: it
+ * parks them, still marked allocated, on a quick list per exact size,
+ * from which mm_malloc takes them back as they are. The quick lists are
+ * swept into the free lists when a search fails or when more than
+ * QUICK_BUDGET bytes are parked.
+ *
+ * mm_malloc_batch carves a run of equal blocks from one free block or
+ * one heap extension in a single pass; mm_free_batch sorts its blocks by
+ * address so that neighbours merge before a single coalesce.
+ *
+ * When a free block at the top of the heap grows past TRIM_THRESHOLD
+ * bytes, mm_free shrinks the heap with a negative mem_sbrk, leaving
+ * TRIM_KEEP free bytes behind so the next allocation need not grow it.
+ *
+ * mm_realloc tags a block it grows with the GROWN header bit. When a
+ * tagged block grows again, it gets REALLOC_SLACK percent extra (at most
+ * REALLOC_SLACK_MAX bytes, both changeable with mm_set_slack), so a run
+ * of small upward reallocs finishes in place; shrinking it below half its
+ * size gives the slack back. Slack never pushes a block into a mapping.
+ *
+ * The same bit marks a free block as ZEROED when its payload is known to
+ * be zero apart from its links and footer. extend_heap sets it on space
+ * memlib reports as never written (mem_zero_lo); splits, merges of two
+ * zeroed blocks and trims keep it, and any other path that writes a free
+ * header drops it. mm_calloc then clears only those three words of a
+ * zeroed block instead of the whole payload.
+ *
+ * Requests of MMAP_THRESHOLD bytes and up bypass the heap: each gets a
+ * mapping of its own from mem_map, headed by a size 0 header, which
+ * mm_free unmaps at once and mm_realloc resizes with mem_remap.
+ *
+ * mm_memalign cuts an aligned block out of a free block large enough to
+ * hold it at any address, returning the slack in front and behind to the
+ * free lists; an aligned mapped block records in its padding word how
+ * far into its mapping it starts.
+ *
+ * mm_halloc hands out a handle instead of an address. The block's first
+ * word names its slot in a handle table, itself an ordinary heap block,
+ * which holds the block's address; its second word counts the pins that
+ * mm_hpin takes and mm_hunpin drops. mm_compact walks the heap in address
+ * order from where its last slice stopped, sliding every unpinned handle
+ * block that follows a free block down over it, so the holes in front of
+ * such blocks drift up and merge; a pass that reaches the epilogue trims
+ * the heap. rover_fix keeps the walk's cursor on a block boundary as
+ * blocks merge between slices. Handle blocks in slab slots or mappings
+ * never move.
+ *
+ * All allocator state (list roots, bitmaps, the lock) lives in a root
+ * struct at the very start of the heap, found through mem_heap_lo() on
+ * every call. Each memlib arena therefore carries its own independent
+ * allocator instance, used by whichever threads have selected it, and
+ * mem_snapshot saves a heap whole; mm_attach picks up the heap that
+ * mem_restore brings back.
  * 
  */
 #include <stdio.h>
@@ -16,10 +116,27 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 
+team_t team = {
+    /* Team name */
+    "bovik",
+    /* First member's full name */
+    "Harry Bovik",
+    /* First member's email address */
+    "bovik@cs.cmu.edu",
+    /* Second member's full name (leave blank if none) */
+    "",
+    /* Second member's email address (leave blank if none) */
+    ""
+};
 
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
@@ -33,59 +150,339 @@
 #define WSIZE	4
 #define DSIZE	8
 #define CHUNKSIZE	(1<<12)
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD	(128*1024)	// free bytes at the heap top that trigger a trim
+#endif
+#define TRIM_KEEP	CHUNKSIZE	// free bytes a trim leaves at the top
+#ifndef REALLOC_SLACK
+#define REALLOC_SLACK	50	// percent of its size a block that keeps growing reserves
+#endif
+#ifndef REALLOC_SLACK_MAX
+#define REALLOC_SLACK_MAX	(64*1024)	// cap on that reserve in bytes
+#endif
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD	(128*1024)	// requests this large get their own mapping
+#endif
+#ifndef QUICK_MAX
+#define QUICK_MAX	128	// largest block mm_free parks on a quick list
+#endif
+#ifndef QUICK_BUDGET
+#define QUICK_BUDGET	(64*1024)	// parked bytes that trigger a coalescing sweep
+#endif
+#define QUICK_CLASSES	(QUICK_MAX/DSIZE+1)
+// largest block a 32-bit header (and a 32-bit offset) can describe
+#define MAX_BLOCK	((size_t)UINT_MAX & ~0x7)
 
 #define MAX(x, y) ((x) > (y)? (x) : (y)) 
+#define MIN(x, y) ((x) < (y)? (x) : (y)) 
 
-#define PACK(size, alloc) ((size) | (alloc))
+#define PACK(size, alloc) ((unsigned int)(size) | (alloc))
+// header bit set when the previous block is allocated
+#define PREV_ALLOC	0x2
+#define GROWN	0x4	// allocated block that mm_realloc has grown before
+#define ZEROED	0x4	// free block whose payload is zero but for the tags
 
 #define GET(p)	(*(unsigned int *)(p))
 #define PUT(p, val)	(*(unsigned int *)(p) = (val))
 
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+// block size for a payload of size bytes: a header plus alignment, and
+// at least the 16 bytes a free block needs for its links and footer
+#define ADJUST(size)	((size) <= DSIZE+WSIZE ? 2*DSIZE : ALIGN((size) + WSIZE))
 
 #define HDRP(bp)	((char *)(bp) - WSIZE)
 #define FTRP(bp)	((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
 #define NEXT_BLKP(bp)	((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
+// only valid when the previous block is free and so has a footer
 #define PREV_BLKP(bp)	((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-#define NEXT_FREE(bp)	((char *)GET(bp))
-#define PREV_FREE(bp)	((char *)GET((char*)(bp) + WSIZE))
+// keep the prev-allocated bit of the block after bp up to date
+#ifdef MM_THREADS
+// the next block may be one whose owner is reading its header in
+// cache_free without the lock, so its PREV_ALLOC bit flips atomically
+#define SET_NEXT_PALLOC(bp)	__atomic_fetch_or((unsigned int *)HDRP(NEXT_BLKP(bp)), PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLR_NEXT_PALLOC(bp)	__atomic_fetch_and((unsigned int *)HDRP(NEXT_BLKP(bp)), ~PREV_ALLOC, __ATOMIC_RELAXED)
+#else
+#define SET_NEXT_PALLOC(bp)	(GET(HDRP(NEXT_BLKP(bp))) |= PREV_ALLOC)
+#define CLR_NEXT_PALLOC(bp)	(GET(HDRP(NEXT_BLKP(bp))) &= ~PREV_ALLOC)
+#endif
+// a block with its own mapping has a size 0 header, which no heap block has
+#define IS_MAPPED(bp)	(GET_SIZE(HDRP(bp)) == 0)
+// a mapped block's padding word holds the bytes skipped to align it
+#define MAP_LEAD(bp)	GET((char *)(bp) - DSIZE)
+#define MAP_BASE(bp)	((char *)(bp) - DSIZE - MAP_LEAD(bp))
+// the first block after the prologue
+#define FIRST_BLKP	NEXT_BLKP(heap_lo + ROOT_SIZE + DSIZE)
+// carve a block from the back of a free block rather than the front?
+#define SPLIT_BACK(asize)	(split_rule==MM_SPLIT_BACK || \
+		(split_rule!=MM_SPLIT_FRONT && ((asize)>=ROOT->split_min) != ROOT->split_flip))
+#define ADAPT_PERIOD	1024	// allocations between two adaptive threshold updates
+
+// convert between block pointers and 32-bit heap offsets (0 is null)
+#define TO_OFF(bp)	((bp) ? (unsigned int)((char *)(bp) - heap_lo) : 0)
+#define TO_PTR(off)	((off) ? heap_lo + (off) : NULL)
+
+// size class of a block: four classes per power of two, class 4*(b-4)+q
+// holding the sizes of bit length b+1 whose next two bits are q (class 0
+// starts at the smallest block of 16 bytes, class 111 ends at 4 GB).
+// Sizes below CLASS_TABLE_MAX are looked up in class_table.
+#define CLASS(size)	size_class(size)
+#define NUM_CLASSES	112
+#define CLASS_WORDS	((NUM_CLASSES+31)/32)
+#define CLASS_TABLE_MAX	1024
+#define MAP_HAS(cls)	(ROOT->class_map[(cls)/32] & (1u << (cls)%32))
+#define MAP_SET(cls)	(ROOT->class_map[(cls)/32] |= 1u << (cls)%32)
+#define MAP_CLR(cls)	(ROOT->class_map[(cls)/32] &= ~(1u << (cls)%32))
+
+// octave of a block size, its bit length minus 5, for the split statistics
+#define OCTAVE(size)	(27 - __builtin_clz((unsigned int)(size)))
+#define NUM_OCTAVES	28
+
+// 'next' link at bp, 'prev' link at bp+WSIZE, both as offsets
+#define NEXT_FREE(bp)	TO_PTR(GET(bp))
+#define PREV_FREE(bp)	TO_PTR(GET((char*)(bp) + WSIZE))
+#define SET_NEXT(bp, p)	PUT(bp, TO_OFF(p))
+#define SET_PREV(bp, p)	PUT((char *)(bp) + WSIZE, TO_OFF(p))
 
-static char *heap_listp;
-static unsigned int *free_list;
+// large classes are treaps: left child at bp, right child at bp+WSIZE
+#define TREE_MIN_SIZE	512
+#define TREE_CLASS	CLASS(TREE_MIN_SIZE)
+#define LEFT(bp)	NEXT_FREE(bp)
+#define RIGHT(bp)	PREV_FREE(bp)
+#define LEFT_LINK(bp)	((unsigned int *)(bp))
+#define RIGHT_LINK(bp)	((unsigned int *)((char *)(bp) + WSIZE))
+// treap order: by size, ties broken by address
+#define TREE_LESS(a, b)	(GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) || \
+	(GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (char *)(a) < (char *)(b)))
 
+// slab pages: header of partial-list links, slot size, free count and
+// a used-slot bitmap, followed by the slots
+#define SLAB_PAGE	1024
+#define SLAB_MAX	32
+#define SLAB_CLASSES	(SLAB_MAX/DSIZE)
+#define SLAB_HDR	32
+#define SLAB_SLOT(pg)	GET((char *)(pg) + 2*WSIZE)
+#define SLAB_NFREE(pg)	GET((char *)(pg) + 3*WSIZE)
+#define SLAB_MAP(pg)	((unsigned int *)((char *)(pg) + 4*WSIZE))
+#define SLAB_SLOTS(slot)	((SLAB_PAGE - WSIZE - SLAB_HDR) / (slot))
+// page number of bp counted from the heap base, and its page start
+#define SLAB_PG(bp)	((unsigned int)((size_t)(bp)/SLAB_PAGE - (size_t)heap_lo/SLAB_PAGE))
+#define SLAB_BASE(bp)	((char *)((size_t)(bp) & ~(size_t)(SLAB_PAGE-1)))
+#define SLAB_DIR_MIN	16	// initial directory bitmap words, enough for 512 KB of heap
+
+// per-thread caches of small objects, by payload capacity in 8-byte steps
+#define CACHE_MAX	256	// largest object kept in a thread cache
+#define CACHE_CLASSES	(CACHE_MAX/DSIZE)
+#define CACHE_BATCH	16	// objects moved per refill or flush
+#define CACHE_LIMIT	64	// cached objects per class that trigger a flush
+
+// handles: slot h of the handle table, whether a slot is free, and the
+// pin count a handle block keeps in the word after its handle
+#define HSLOT(h)	(ROOT->htab + (h))
+#define HSLOT_FREE(s)	((s)->next & 1)
+#define HPINS(bp)	GET((char *)(bp) + WSIZE)
+#define HTAB_MIN	64	// slots in a new handle table
+
+#ifdef MM_THREADS
+#define LOCK()	pthread_mutex_lock(&ROOT->lock)
+#define UNLOCK()	pthread_mutex_unlock(&ROOT->lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+// a handle table slot: the block of a live handle, or for a free slot
+// the next free one, tagged by the low bit
+typedef union {
+	char *bp;
+	size_t next;	// 2*next+1
+} hslot_t;
+
+// allocator state at the start of every heap
+typedef struct {
+	unsigned int free_list[NUM_CLASSES];	// segregated list and treap roots
+	unsigned int class_map[CLASS_WORDS];	// bit i set iff free_list[i] is non-empty
+	unsigned int slab_list[SLAB_CLASSES];	// slab pages with free slots
+	unsigned int slab_dir;	// offset of the slab directory: capacity in words, then the bitmap
+	unsigned int rover;	// where the next next-fit search starts, 0 for the first block
+	unsigned int split_min;	// smallest block carved from the back of a free block,
+	unsigned int split_flip;	// or, if set, largest block carved from the front
+	unsigned int live[NUM_OCTAVES];	// allocated blocks per octave (adaptive split only)
+	unsigned int recent[NUM_OCTAVES];	// decaying count of allocations per octave
+	unsigned int clock;	// allocations counted so far
+	unsigned int quick[QUICK_CLASSES];	// parked blocks by size/8, linked through the payload
+	unsigned int quick_bytes;	// bytes parked on all quick lists
+	hslot_t *htab;	// handle table, slot 0 unused so that 0 is no handle
+	unsigned int hcap;	// slots in the handle table
+	unsigned int hfree;	// first free slot, 0 if none
+	unsigned int hcursor;	// block the next compaction slice starts at, 0 for a new pass
+#ifdef MM_THREADS
+	pthread_mutex_t lock;
+	unsigned int epoch;	// generation of this heap, for thread caches
+#endif
+} heap_root_t;
+
+#define ROOT	((heap_root_t *)heap_lo)
+#define ROOT_SIZE	ALIGN(sizeof(heap_root_t))
+
+// base of the heap being worked on, set from mem_heap_lo() by every entry point
+static __thread char *heap_lo;
+
+// realloc slack, shared by all heaps
+static int slack_pct = REALLOC_SLACK;	// reserve after a block that keeps growing, in percent
+static size_t slack_max = REALLOC_SLACK_MAX;	// and at most this many bytes
+
+// placement policy, shared by all heaps
+static int fit_policy = MM_BEST_FIT;
+static int fit_k = 1;	// candidates a good-fit search looks at
+static int split_rule = MM_SPLIT_ADAPTIVE;
+static size_t split_min = 96;	// initial threshold of MM_SPLIT_SIZE and MM_SPLIT_ADAPTIVE
+
+#ifdef MM_THREADS
+static unsigned int heap_epoch;	// bumped by mm_init to invalidate thread caches
+static pthread_key_t cache_key;	// flushes a thread's cache when it exits
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static __thread void *cache_head[CACHE_CLASSES];
+static __thread unsigned int cache_count[CACHE_CLASSES];
+static __thread char *cache_heap;	// heap and epoch the cached objects belong to
+static __thread unsigned int cache_epoch;
+#endif
+
+static int heap_init(void);
+static void *heap_malloc(size_t size);
+static void heap_free(void *bp);
+static void free_block(void *bp);
+static void release(void *bp);
+static void *heap_malloc_class(int cls);
+static void *heap_calloc(size_t size);
+static void *quick_take(size_t asize);
+#ifdef DEBUG
+static void check_size(void *bp, size_t size);
+#endif
+static void *heap_realloc(void *ptr, size_t size);
 static void *extend_heap(size_t words);
+static inline int size_class(size_t size);
 static void *find_fit(size_t asize);
+static void *seg_fit(size_t asize);
+static void quick_flush(void);
+static void *next_fit(size_t asize);
+static void rover_fix(char *bp, size_t size);
+static void adapt_count(size_t size, int d);
+static void adapt_split(void);
 static void *place(void *bp, size_t asize);
 static void cut(void *bp);
 static void connect(void *bp);
 static void *coalesce(void *bp);
+static void wipe_seam(char *bp);
+static int heap_malloc_batch(size_t size, int n, void **out);
+static int carve(char *bp, size_t asize, int n, void **out);
+static void heap_free_batch(void **ptrs, int n);
+static void trim(void *bp);
+static void shrink(void *bp);
+static void tree_insert(unsigned int *root, char *bp);
+static void tree_remove(unsigned int *root, char *bp);
+static char *tree_fit(unsigned int root, size_t asize);
+static void *realloc_place(char *bp, size_t size, size_t asize, unsigned int palloc);
+static void *alloc_aligned(size_t asize, size_t align);
+static void *map_alloc(size_t size, size_t align);
+static void *heap_memalign(size_t align, size_t size);
+static void *slab_alloc(size_t size);
+static int slab_owns(void *bp);
+static void slab_free(void *bp);
+static mm_handle_t heap_halloc(size_t size);
+static int htab_grow(void);
+static hslot_t *hslot(mm_handle_t h);
+static int heap_compact(size_t budget);
+static mm_handle_t movable(char *bp);
+static char *slide(char *bp, char *next);
+#ifdef MM_THREADS
+static void *cache_alloc(size_t size);
+static void cache_free(void *bp);
+static void cache_put(void *bp, int i);
+#endif
+
+/*
+ * mm_set_fit - choose how free blocks are searched; k is the number of
+ *     candidates for MM_GOOD_FIT
+ */
+void mm_set_fit(int policy, int k)
+{
+	fit_policy = policy;
+	fit_k = k>0 ? k : 1;
+}
+
+/*
+ * mm_set_split - choose which end of a free block an allocation is
+ *     carved from; threshold only matters for MM_SPLIT_SIZE
+ */
+void mm_set_split(int rule, size_t threshold)
+{
+	split_rule = rule;
+	split_min = threshold;
+}
+
+/*
+ * mm_set_slack - choose the slack a block that keeps growing under
+ *     realloc reserves: percent of its size, at most max bytes; 0 turns
+ *     it off
+ */
+void mm_set_slack(int percent, size_t max)
+{
+	slack_pct = percent>0 ? percent : 0;
+	slack_max = max;
+}
 
 /* 
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
-{	//apply a new space of 32 words
-    if((heap_listp = mem_sbrk(16*DSIZE)) == (void *)-1)
+{
+	return heap_init();
+}
+
+/*
+ * mm_attach - Take over a heap brought back by mem_restore, as it was
+ *     when saved. Objects then held in thread caches are lost. Returns
+ *     -1 if the arena holds no heap.
+ */
+int mm_attach(void)
+{
+	heap_lo = mem_heap_lo();
+	if(mem_heapsize() < ROOT_SIZE + 2*DSIZE ||
+			GET(heap_lo + ROOT_SIZE + WSIZE) != PACK(DSIZE, PREV_ALLOC|1))
+		return -1;
+#ifdef MM_THREADS
+	//the saved lock and cache epoch belong to another run
+	pthread_mutex_init(&ROOT->lock, NULL);
+	ROOT->epoch = __atomic_add_fetch(&heap_epoch, 1, __ATOMIC_RELAXED);
+#endif
+	return 0;
+}
+
+// heap_init - lay out the heap root, prologue and epilogue
+static int heap_init(void)
+{
+	char *heap_listp;
+	//apply space for the root, alignment padding, prologue and epilogue
+    if((heap_lo = mem_sbrk(ROOT_SIZE + 2*DSIZE)) == (void *)-1)
     	return -1;
+    //all list roots and bitmaps start out empty
+    memset(ROOT, 0, ROOT_SIZE);
+#ifdef MM_THREADS
+	pthread_mutex_init(&ROOT->lock, NULL);
+	ROOT->epoch = __atomic_add_fetch(&heap_epoch, 1, __ATOMIC_RELAXED);
+#endif
+	ROOT->split_min = MAX(MIN(split_min, MAX_BLOCK), 2*DSIZE);
     
+    heap_listp = heap_lo + ROOT_SIZE;
     PUT(heap_listp, 0); //alignment padding
-    //the first size class contains the free blocks with size from 16-32
-    int cnt = 5;
-    //allocate space for separated linked list
-    free_list = (unsigned int*)(heap_listp + WSIZE);
-    //set pointers in separated linked list as null
-	while(cnt<=32) {
-		PUT(heap_listp+(cnt-4)*WSIZE, 0);
-		cnt++;
-	} 
-
-    PUT(heap_listp + (29*WSIZE), PACK(DSIZE, 1)); //prologue header
-    PUT(heap_listp + (30*WSIZE), PACK(DSIZE, 1)); //prologue footer
-    PUT(heap_listp + (31*WSIZE), PACK(0, 1));     //epilogue header
-    heap_listp += (15*DSIZE);
+    PUT(heap_listp + (1*WSIZE), PACK(DSIZE, PREV_ALLOC|1)); //prologue header
+    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); //prologue footer
+    PUT(heap_listp + (3*WSIZE), PACK(0, PREV_ALLOC|1));     //epilogue header
     //extend the empty heap with a free block of CHUNKSIZE bytes
     if(extend_heap(CHUNKSIZE/WSIZE) == NULL)
     	return -1;
@@ -98,33 +495,60 @@ static void *extend_heap(size_t words) {
 	size_t size;
 	// always allocate even number of words to maintain alignment
 	size = (words % 2)? (words+1) * WSIZE : words * WSIZE;
+	// mem_sbrk takes an int and headers hold 32-bit sizes
+	if(size > INT_MAX || size > MAX_BLOCK)
+		return NULL;
+	//space no brk has passed since it was last zeroed is zero
+	unsigned int zeroed = (char *)mem_zero_lo() <= (char *)mem_heap_hi() + 1 ? ZEROED : 0;
 	if((long)(bp = mem_sbrk(size)) == -1)
 		return NULL;
-	//Initialize free block header/footer and the epilogue header
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
+	//Initialize free block header/footer and the epilogue header,
+	//the old epilogue header knows whether the last block is allocated
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))|zeroed));
+	PUT(FTRP(bp), GET(HDRP(bp)));
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
 	//coalesce if the previous block was free
 	return coalesce(bp);
 }
 
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+ * mm_malloc - Allocate a block of at least size bytes, 8-byte aligned.
+ *     With threads, sizes up to CACHE_MAX come from this thread's cache
+ *     without the lock; everything else goes to heap_malloc under it.
  */
 void *mm_malloc(size_t size)
+{
+	heap_lo = mem_heap_lo();
+#ifdef MM_THREADS
+	if(size!=0 && size<=CACHE_MAX)
+		return cache_alloc(size);
+#endif
+	LOCK();
+	void *bp = heap_malloc(size);
+	UNLOCK();
+	return bp;
+}
+
+// heap_malloc - allocate from the heap, with the heap lock held
+static void *heap_malloc(size_t size)
 {	
 	size_t asize; 			//adjusted block size
 	size_t extendsize;		//amount to extend heap if no fit
 	char *bp;
 	//ignore spurious requests
-	if(size==0) 
+	if(size==0 || size > MAX_BLOCK - DSIZE) 
 		return NULL;
+	//large objects get a mapping of their own
+	if(size >= MMAP_THRESHOLD)
+		return map_alloc(size, DSIZE);
+	//small objects go to a headerless slab slot when possible
+	if(size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL)
+		return bp;
 	//adjust block size to include overhead and alignment reqs.
-	if(size <= DSIZE)
-		asize = 2*DSIZE;
-	//round up
-	else asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+	asize = ADJUST(size);
+	//a parked block of the exact size needs neither a search nor a split
+	if(asize<=QUICK_MAX && (bp = quick_take(asize)) != NULL)
+		return bp;
 	//search the free list for a fit
 	if((bp = find_fit(asize)) != NULL) {
 		bp = place(bp, asize);
@@ -137,184 +561,1015 @@ void *mm_malloc(size_t size)
 	bp = place(bp, asize);
 	return bp;
 }
-// find fit free block
+// class of every block size below CLASS_TABLE_MAX, indexed by size/8
+static const unsigned char class_table[CLASS_TABLE_MAX/DSIZE] = {
+	0, 0, 0, 2, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+	16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
+	18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19,
+	20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+	21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+	22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+	23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+};
+
+// size class of a block of size bytes
+static inline int size_class(size_t size) {
+	if(size < CLASS_TABLE_MAX)
+		return class_table[size/DSIZE];
+	int b = 31 - __builtin_clz((unsigned int)size);
+	return 4*(b-4) + (int)((size >> (b-2)) & 3);
+}
+
+// find fit free block, sweeping the quick lists into the free lists
+// before giving up
 static void *find_fit(size_t asize) {
-	int cnt = 0;
-	size_t size = asize;
-	//find the smallest fit size class
-	while(size!=0) {
-		size=size>>1;
-		cnt++;
-	} 
-	//since the smallest size of block is 16
-	//the minimum value of cnt is 5
-	while(cnt<=32) {
-		if(free_list[cnt-5]==0) {
-			cnt++; continue;
-		}
+	void *bp = seg_fit(asize);
+	if(bp==NULL && ROOT->quick_bytes!=0) {
+		quick_flush();
+		bp = seg_fit(asize);
+	}
+	return bp;
+}
+
+// search the free lists (or the heap, for next fit) for a fit
+static void *seg_fit(size_t asize) {
+	if(fit_policy==MM_NEXT_FIT)
+		return next_fit(asize);
+	int cls = CLASS(asize);
+	unsigned int map;
+	int w;
+	char *p;
+	//blocks in the smallest fit class may still be too small, so search it
+	if(MAP_HAS(cls)) {
+		if(cls >= TREE_CLASS)
+			p = tree_fit(ROOT->free_list[cls], asize);
 		else {
-			//initially the pointer points to the head
-			char *p = (char *)free_list[cnt-5];
-			//find smallest fit free block
-			while(p!=0 && GET_SIZE(HDRP(p))<asize) {
+			p = TO_PTR(ROOT->free_list[cls]);
+			while(p!=NULL && GET_SIZE(HDRP(p))<asize) {
 				p = NEXT_FREE(p);
-			} 
-			//no fit found
-			if(p==0) {
-				cnt++; continue;
-			}
-			//return free block
-			else {
-				return (void *)p;
 			}
 		}
-		
+		if(p!=NULL)
+			return (void *)p;
 	}
-	
+	//every block of a larger class fits, so the smallest block of the
+	//first non-empty one is the best fit
+	cls++;
+	for(w=cls/32; w<CLASS_WORDS; w++) {
+		map = ROOT->class_map[w];
+		if(w==cls/32)
+			map &= ~0u << cls%32;
+		if(map!=0)
+			break;
+	}
+	if(w==CLASS_WORDS)
+		return NULL;
+	cls = w*32 + __builtin_ctz(map);
+	if(cls >= TREE_CLASS)
+		return (void *)tree_fit(ROOT->free_list[cls], 0);
+	return (void *)TO_PTR(ROOT->free_list[cls]);
+}
+
+// walk the heap from the rover to the first free block that fits,
+// wrapping around at the epilogue
+static void *next_fit(size_t asize) {
+	char *start = ROOT->rover ? TO_PTR(ROOT->rover) : FIRST_BLKP;
+	char *bp = start;
+	do {
+		if(GET_SIZE(HDRP(bp))==0)
+			bp = FIRST_BLKP;
+		else if(!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp))>=asize) {
+			ROOT->rover = TO_OFF(bp);
+			return bp;
+		}
+		else bp = NEXT_BLKP(bp);
+	} while(bp!=start);
 	return NULL;
 }
 
+// bp now spans size bytes: move the rover and the compaction cursor to
+// bp if they pointed inside
+static void rover_fix(char *bp, size_t size) {
+	unsigned int off = TO_OFF(bp);
+	if(ROOT->rover > off && ROOT->rover < off + size)
+		ROOT->rover = off;
+	if(ROOT->hcursor > off && ROOT->hcursor < off + size)
+		ROOT->hcursor = off;
+}
+
+// count an allocated block of size bytes coming (d=1) or going (d=-1),
+// re-picking the adaptive split threshold every ADAPT_PERIOD allocations
+static void adapt_count(size_t size, int d) {
+	if(split_rule!=MM_SPLIT_ADAPTIVE)
+		return;
+	int oct = OCTAVE(size);
+	ROOT->live[oct] += d;
+	if(d<0)
+		return;
+	ROOT->recent[oct]++;
+	if(++ROOT->clock % ADAPT_PERIOD == 0)
+		adapt_split();
+}
+
+// set the split threshold to the octave boundary that best separates the
+// octaves whose blocks live over twice as long as the average, carved from
+// the back, from those living under half as long, carved from the front,
+// whichever side of the boundary the long-lived ones are. By Little's law
+// the mean lifetime of an octave is proportional to live/recent. Each octave
+// weighs as much as its recent allocations, which are then halved to age
+// them. The threshold only moves if that misplaces fewer blocks.
+static void adapt_split(void) {
+	unsigned long long live = 0, recent = 0;
+	long long cost = 0, decided = 0, best_cost, cur_cost, flip_cost;
+	int side[NUM_OCTAVES];	// 1 long-lived, -1 short-lived, 0 neither
+	int c, best = 0, flip = 0;
+	int cur = MIN(OCTAVE(ROOT->split_min-1)+1, NUM_OCTAVES);	// nearest octave boundary
+	for(c=0; c<NUM_OCTAVES; c++) {
+		live += ROOT->live[c];
+		recent += ROOT->recent[c];
+	}
+	// with the threshold below octave 0, every short-lived octave is misplaced
+	for(c=0; c<NUM_OCTAVES; c++) {
+		unsigned long long lc = (unsigned long long)ROOT->live[c]*recent;
+		unsigned long long rc = live*ROOT->recent[c];
+		side[c] = lc > 2*rc ? 1 : 2*lc < rc ? -1 : 0;
+		if(side[c]!=0)
+			decided += ROOT->recent[c];
+		if(side[c]<0)
+			cost += ROOT->recent[c];
+	}
+	// flipping the sides misplaces exactly the decided blocks that were not
+	flip = decided-cost < cost;
+	best_cost = flip ? decided-cost : cost;
+	cur_cost = ROOT->split_flip ? decided-cost : cost;
+	// raising the threshold past octave c moves that octave to the front
+	for(c=0; c<NUM_OCTAVES; c++) {
+		cost += side[c]*(long long)ROOT->recent[c];
+		flip_cost = decided-cost;
+		if(c+1==cur)
+			cur_cost = ROOT->split_flip ? flip_cost : cost;
+		if(MIN(cost, flip_cost) < best_cost) {
+			flip = flip_cost < cost;
+			best_cost = MIN(cost, flip_cost);
+			best = c+1;
+		}
+	}
+	if(best_cost < cur_cost) {
+		ROOT->split_min = best<NUM_OCTAVES ? 2*DSIZE << best : MAX_BLOCK;
+		ROOT->split_flip = flip;
+	}
+	for(c=0; c<NUM_OCTAVES; c++)
+		ROOT->recent[c] /= 2;
+}
+
 // get the requested block and generate new free block
 static void *place(void *bp, size_t asize) {
 	size_t size = GET_SIZE(HDRP(bp));
+	unsigned int palloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int zeroed = GET(HDRP(bp)) & ZEROED;	// the spare block stays zeroed
 	cut(bp); //take out bp from the linked list
 	
 	// if the size of spare block <16, keep it as internal fragmentation
 	if(size-asize<16) {
-		PUT(HDRP(bp), PACK(size, 1));
-		PUT(FTRP(bp), PACK(size, 1));
+		PUT(HDRP(bp), PACK(size, palloc|1));
+		SET_NEXT_PALLOC(bp);
 	}
 	// keep the small free block at the front of the memory
-	else if(asize>=96){
-		PUT(FTRP(bp), PACK(asize, 1));
-		PUT((char *)(bp)+size-asize-WSIZE, PACK(asize, 1));
-		PUT(HDRP(bp), PACK(size-asize, 0));
-		PUT(FTRP(bp), PACK(size-asize, 0));
+	else if(SPLIT_BACK(asize)){
+		PUT(HDRP(bp), PACK(size-asize, palloc|zeroed));
+		PUT(FTRP(bp), PACK(size-asize, palloc|zeroed));
 		char *p = bp;
 		connect(p);
 		bp = (char *)(bp)+size-asize;
+		PUT(HDRP(bp), PACK(asize, 1));
+		SET_NEXT_PALLOC(bp);
 	}
 	// keep the large free block at the end of the memory
 	else {
-		PUT(FTRP(bp), PACK(size-asize, 0));
-		PUT((char *)(bp)+asize-WSIZE, PACK(size-asize, 0));
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+		PUT(HDRP(bp), PACK(asize, palloc|1));
 		char *p = (char *)(bp)+asize;
+		PUT(HDRP(p), PACK(size-asize, PREV_ALLOC|zeroed));
+		PUT(FTRP(p), PACK(size-asize, PREV_ALLOC|zeroed));
 		connect(p);
 	}
+	adapt_count(GET_SIZE(HDRP(bp)), 1);
 	return bp;	
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * mm_free - Free a block. With threads, cache_free keeps small blocks in
+ *     this thread's cache and takes the lock only for the rest;
+ *     otherwise heap_free releases the block at once.
  */
 void mm_free(void *bp)
+{
+	heap_lo = mem_heap_lo();
+#ifdef MM_THREADS
+	cache_free(bp);
+#else
+	heap_free(bp);
+#endif
+}
+
+// heap_free - return a block to the heap, with the heap lock held
+static void heap_free(void *bp)
+{
+	if(slab_owns(bp)) {
+		slab_free(bp);
+		return;
+	}
+	if(IS_MAPPED(bp)) {
+		mem_unmap(MAP_BASE(bp));
+		return;
+	}
+	free_block(bp);
+}
+
+// free_block - free a block of the heap proper, neither a slab slot nor
+// a mapping
+static void free_block(void *bp)
 {
 	size_t size = GET_SIZE(HDRP(bp));
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	coalesce(bp);
+	adapt_count(size, -1);
+	//park small blocks still marked allocated, so that the next request
+	//of the same size takes them back without a merge and a split
+	if(size<=QUICK_MAX) {
+		PUT(HDRP(bp), GET(HDRP(bp)) & ~GROWN);
+		PUT(bp, ROOT->quick[size/DSIZE]);
+		ROOT->quick[size/DSIZE] = TO_OFF(bp);
+		if((ROOT->quick_bytes += size) > QUICK_BUDGET)
+			quick_flush();
+		return;
+	}
+	release(bp);
+}
+
+// take a block of asize bytes off its quick list, if there is one
+static void *quick_take(size_t asize) {
+	char *bp = TO_PTR(ROOT->quick[asize/DSIZE]);
+	if(bp==NULL)
+		return NULL;
+	ROOT->quick[asize/DSIZE] = GET(bp);
+	ROOT->quick_bytes -= asize;
+	adapt_count(asize, 1);
+	return bp;
+}
+
+/*
+ * mm_free_sized - Free a block whose requested size the caller knows.
+ *     A size between SLAB_MAX and MMAP_THRESHOLD rules out a slab slot
+ *     and a mapping, so neither needs looking up. A smaller size proves
+ *     nothing about the block, which realloc may have shrunk in place,
+ *     so it takes the mm_free path.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+	heap_lo = mem_heap_lo();
+#ifdef DEBUG
+	check_size(bp, size);
+#endif
+#ifdef MM_THREADS
+	// the block may hold more than size implies, so its cache class
+	// comes from the block itself
+	if(size <= CACHE_MAX) {
+		cache_free(bp);
+		return;
+	}
+#endif
+	LOCK();
+	if(size > SLAB_MAX && size < MMAP_THRESHOLD)
+		free_block(bp);
+	else
+		heap_free(bp);
+	UNLOCK();
+}
+
+/*
+ * mm_malloc_class - Allocate a block for class cls, that is for
+ *     MM_CLASS_SIZE(cls) bytes, skipping the size checks of mm_malloc.
+ */
+void *mm_malloc_class(int cls)
+{
+	if(cls < 1 || cls > MM_CLASSES)
+		return NULL;
+	heap_lo = mem_heap_lo();
+#ifdef MM_THREADS
+	if(MM_CLASS_SIZE(cls) <= CACHE_MAX)
+		return cache_alloc(MM_CLASS_SIZE(cls));
+#endif
+	LOCK();
+	void *bp = heap_malloc_class(cls);
+	UNLOCK();
+	return bp;
+}
+
+// heap_malloc_class - allocate for a class, with the heap lock held
+static void *heap_malloc_class(int cls)
+{
+	size_t size = MM_CLASS_SIZE(cls);
+	void *bp;
+	if(size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL)
+		return bp;
+	if(ADJUST(size) <= QUICK_MAX && (bp = quick_take(ADJUST(size))) != NULL)
+		return bp;
+	return heap_malloc(size);
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes.
+ *     A block carved from a free block known to be zero only needs the
+ *     free block's tags cleared; any other is zeroed in full.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+	void *bp;
+	if(size!=0 && nmemb > (size_t)-1/size)
+		return NULL;
+	size *= nmemb;
+	heap_lo = mem_heap_lo();
+#ifdef MM_THREADS
+	if(size!=0 && size<=CACHE_MAX) {
+		if((bp = cache_alloc(size)) != NULL)
+			memset(bp, 0, size);
+		return bp;
+	}
+#endif
+	LOCK();
+	bp = heap_calloc(size);
+	UNLOCK();
+	return bp;
+}
+
+// heap_calloc - allocate a zeroed block, with the heap lock held
+static void *heap_calloc(size_t size)
+{
+	size_t asize;
+	char *bp;
+	if(size==0 || size > MAX_BLOCK - DSIZE) 
+		return NULL;
+	//a new mapping comes zeroed
+	if(size >= MMAP_THRESHOLD)
+		return map_alloc(size, DSIZE);
+	asize = ADJUST(size);
+	//slab slots and parked blocks have been written before
+	if(size <= SLAB_MAX || (asize<=QUICK_MAX && ROOT->quick[asize/DSIZE]!=0)) {
+		if((bp = heap_malloc(size)) != NULL)
+			memset(bp, 0, size);
+		return bp;
+	}
+	if((bp = find_fit(asize)) == NULL && 
+			(bp = extend_heap(MAX(asize, CHUNKSIZE)/WSIZE)) == NULL)
+		return NULL;
+	unsigned int zeroed = GET(HDRP(bp)) & ZEROED;
+	bp = place(bp, asize);
+	if(zeroed) {
+		//the links at the front of the free block and its footer at the
+		//back may have landed in this block
+		memset(bp, 0, DSIZE);
+		PUT(bp + GET_SIZE(HDRP(bp)) - DSIZE, 0);
+	}
+	else memset(bp, 0, size);
+	return bp;
+}
+
+/*
+ * mm_memalign - Allocate size bytes at a multiple of align, a power of
+ *     two. The block is carved out of a free block at the right offset,
+ *     and the slack on either side goes back to the free lists.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+	if(align==0 || (align & (align-1))!=0)
+		return NULL;
+	heap_lo = mem_heap_lo();
+	LOCK();
+	void *bp = heap_memalign(align, size);
+	UNLOCK();
+	return bp;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc: mm_memalign, for a size that is
+ *     a multiple of align.
+ */
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+	if(align==0 || size % align != 0)
+		return NULL;
+	return mm_memalign(align, size);
+}
+
+// heap_memalign - allocate an aligned block, with the heap lock held
+static void *heap_memalign(size_t align, size_t size)
+{
+	if(align <= DSIZE)
+		return heap_malloc(size);
+	if(size==0 || align > MAX_BLOCK/4 || size > MAX_BLOCK - 2*align)
+		return NULL;
+	if(size >= MMAP_THRESHOLD)
+		return map_alloc(size, align);
+	return alloc_aligned(ADJUST(size), align);
+}
+
+/*
+ * mm_halloc - Allocate size bytes that mm_compact may move while no pin
+ *     holds them. Returns a handle for mm_hpin, or 0 on failure.
+ */
+mm_handle_t mm_halloc(size_t size)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	mm_handle_t h = heap_halloc(size);
+	UNLOCK();
+	return h;
+}
+
+// heap_halloc - allocate a handle block, with the heap lock held
+static mm_handle_t heap_halloc(size_t size)
+{
+	char *bp;
+	mm_handle_t h;
+	if(size==0 || size > MAX_BLOCK - 2*DSIZE)
+		return 0;
+	if(ROOT->hfree==0 && htab_grow() < 0)
+		return 0;
+	//the block starts with its handle, so the compactor finds the slot
+	if((bp = heap_malloc(size + DSIZE)) == NULL)
+		return 0;
+	h = ROOT->hfree;
+	ROOT->hfree = HSLOT(h)->next >> 1;
+	HSLOT(h)->bp = bp;
+	PUT(bp, h);
+	HPINS(bp) = 0;
+	return h;
+}
+
+// double the handle table, putting the new slots on the free list lowest
+// first
+static int htab_grow(void) {
+	unsigned int cap = ROOT->hcap;
+	unsigned int ncap = cap ? 2*cap : HTAB_MIN;
+	unsigned int h;
+	hslot_t *tab;
+	if(ncap > (MAX_BLOCK - DSIZE)/sizeof(hslot_t))
+		return -1;
+	if((tab = heap_malloc(ncap*sizeof(hslot_t))) == NULL)
+		return -1;
+	tab[0].bp = NULL;
+	if(cap!=0) {
+		memcpy(tab, ROOT->htab, cap*sizeof(hslot_t));
+		heap_free(ROOT->htab);
+	}
+	for(h=ncap-1; h>=MAX(cap, 1); h--) {
+		tab[h].next = 2*(size_t)ROOT->hfree + 1;
+		ROOT->hfree = h;
+	}
+	ROOT->htab = tab;
+	ROOT->hcap = ncap;
+	return 0;
 }
-// coalesce free blocks
+
+// the slot of handle h, or NULL if h is not a live handle
+static hslot_t *hslot(mm_handle_t h) {
+	if(h==0 || h>=ROOT->hcap || HSLOT_FREE(HSLOT(h)))
+		return NULL;
+	return HSLOT(h);
+}
+
+/*
+ * mm_hpin - Return the address of the block of handle h, which stays
+ *     put until a matching mm_hunpin. Returns NULL if h is not live.
+ */
+void *mm_hpin(mm_handle_t h)
+{
+	char *p = NULL;
+	heap_lo = mem_heap_lo();
+	LOCK();
+	hslot_t *s = hslot(h);
+	if(s!=NULL) {
+		HPINS(s->bp)++;
+		p = s->bp + DSIZE;
+	}
+	UNLOCK();
+	return p;
+}
+
+/*
+ * mm_hunpin - Drop a pin taken by mm_hpin; once none is left, addresses
+ *     from mm_hpin are stale and the block may move.
+ */
+void mm_hunpin(mm_handle_t h)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	hslot_t *s = hslot(h);
+	if(s!=NULL && HPINS(s->bp)!=0)
+		HPINS(s->bp)--;
+	UNLOCK();
+}
+
+/*
+ * mm_hrealloc - Resize the block of handle h, which may move even if
+ *     pinned. Returns -1, leaving the block as it was, if there is no
+ *     room.
+ */
+int mm_hrealloc(mm_handle_t h, size_t size)
+{
+	int ret = -1;
+	char *bp;
+	heap_lo = mem_heap_lo();
+	LOCK();
+	hslot_t *s = hslot(h);
+	if(s!=NULL && size <= MAX_BLOCK - 2*DSIZE &&
+			(bp = heap_realloc(s->bp, size + DSIZE)) != NULL) {
+		s->bp = bp;
+		ret = 0;
+	}
+	UNLOCK();
+	return ret;
+}
+
+/*
+ * mm_hfree - Free the block of handle h, pinned or not, and the handle.
+ */
+void mm_hfree(mm_handle_t h)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	hslot_t *s = hslot(h);
+	if(s!=NULL) {
+		heap_free(s->bp);
+		s->next = 2*(size_t)ROOT->hfree + 1;
+		ROOT->hfree = h;
+	}
+	UNLOCK();
+}
+
+/*
+ * mm_compact - Run one slice of incremental compaction, moving about
+ *     budget bytes: unpinned handle blocks slide down over the free block
+ *     in front of them. The slice stops where the next one resumes; a
+ *     pass that reaches the end of the heap trims it. Returns 1 while a
+ *     pass is under way and 0 once it has finished.
+ */
+int mm_compact(size_t budget)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	int more = heap_compact(budget);
+	UNLOCK();
+	return more;
+}
+
+// heap_compact - run a compaction slice, with the heap lock held
+static int heap_compact(size_t budget)
+{
+	size_t work = 0;
+	char *bp;
+	//a new pass starts with the quick lists swept, as parked blocks
+	//would stop the slides
+	if(ROOT->hcursor==0) {
+		quick_flush();
+		bp = FIRST_BLKP;
+	}
+	else bp = TO_PTR(ROOT->hcursor);
+	//every block passed costs a word, every block moved its size
+	while(GET_SIZE(HDRP(bp))!=0 && work<budget) {
+		char *next = NEXT_BLKP(bp);
+		work += WSIZE;
+		if(!GET_ALLOC(HDRP(bp)) && movable(next)) {
+			work += GET_SIZE(HDRP(next));
+			bp = slide(bp, next);
+		}
+		else bp = next;
+	}
+	if(GET_SIZE(HDRP(bp))!=0) {
+		ROOT->hcursor = TO_OFF(bp);
+		return 1;
+	}
+	ROOT->hcursor = 0;
+	//the free space the pass gathered at the top goes back to memlib
+	bp = (char *)mem_heap_hi() + 1;
+	if(!GET_PREV_ALLOC(HDRP(bp)))
+		shrink(PREV_BLKP(bp));
+	return 0;
+}
+
+// the handle of bp if it is an unpinned handle block, else 0; the slot
+// must name bp back, as any allocated block may start with a small number
+static mm_handle_t movable(char *bp) {
+	if(GET_SIZE(HDRP(bp))==0 || !GET_ALLOC(HDRP(bp)))
+		return 0;
+	hslot_t *s = hslot(GET(bp));
+	return s!=NULL && s->bp==bp && HPINS(bp)==0 ? GET(bp) : 0;
+}
+
+// slide the handle block next down over the free block bp in front of it;
+// the free space moves behind it and merges with what follows
+static char *slide(char *bp, char *next) {
+	size_t fsize = GET_SIZE(HDRP(bp));
+	size_t size = GET_SIZE(HDRP(next));
+	unsigned int grown = GET(HDRP(next)) & GROWN;
+	cut(bp);
+	rover_fix(bp, fsize + size);
+	memmove(bp, next, size - WSIZE);
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))|grown|1));
+	HSLOT(GET(bp))->bp = bp;
+	char *p = bp + size;
+	PUT(HDRP(p), PACK(fsize, PREV_ALLOC));
+	PUT(FTRP(p), PACK(fsize, PREV_ALLOC));
+	CLR_NEXT_PALLOC(p);
+	return coalesce(p);
+}
+
+#ifdef DEBUG
+// check_size - the block bp must be allocated and hold size bytes, as
+// a wrong size could send it down the wrong free path
+static void check_size(void *bp, size_t size)
+{
+	if(slab_owns(bp))
+		assert(size <= SLAB_SLOT(SLAB_BASE(bp)));
+	else if(IS_MAPPED(bp))
+		assert(size >= MMAP_THRESHOLD);	// smaller ones move to the heap
+	else {
+		assert(GET_ALLOC(HDRP(bp)));
+		assert(size <= GET_SIZE(HDRP(bp)) - WSIZE);
+	}
+}
+#endif
+
+// turn the allocated block bp into a free block and coalesce it
+static void release(void *bp) {
+	PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)), GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), GET(HDRP(bp)));
+	CLR_NEXT_PALLOC(bp);
+	trim(coalesce(bp));
+}
+
+// free every parked block for real
+static void quick_flush(void) {
+	int i;
+	for(i=0; i<QUICK_CLASSES; i++) {
+		while(ROOT->quick[i]!=0) {
+			char *bp = TO_PTR(ROOT->quick[i]);
+			ROOT->quick[i] = GET(bp);
+			release(bp);
+		}
+	}
+	ROOT->quick_bytes = 0;
+}
+
+/*
+ * mm_malloc_batch - Allocate up to n blocks of size bytes into out[],
+ *     carved from a single free block when possible. Returns how many
+ *     were allocated.
+ */
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	int done = heap_malloc_batch(size, n, out);
+	UNLOCK();
+	return done;
+}
+
+// heap_malloc_batch - allocate a batch, with the heap lock held
+static int heap_malloc_batch(size_t size, int n, void **out)
+{
+	int i = 0;
+	char *bp;
+	if(size==0 || size > MAX_BLOCK - DSIZE) 
+		return 0;
+	//slab slots and mapped blocks come one at a time anyway
+	if(size <= SLAB_MAX || size >= MMAP_THRESHOLD) {
+		while(i<n && (out[i] = heap_malloc(size)) != NULL)
+			i++;
+		return i;
+	}
+	size_t asize = ADJUST(size);
+	while(i<n) {
+		size_t want = MIN((size_t)(n-i), MAX_BLOCK/asize) * asize;
+		//one free block for the whole run, or one heap extension, which
+		//merges with a free block at the top
+		if((bp = find_fit(want)) == NULL) {
+			char *brk = (char *)mem_heap_hi() + 1;
+			size_t top = GET_PREV_ALLOC(brk - WSIZE) ? 0 : GET_SIZE(brk - DSIZE);
+			if(top >= want)
+				bp = brk - top;
+			else if((bp = extend_heap((want - top)/WSIZE)) == NULL)
+				break;
+		}
+		i += carve(bp, asize, n-i, out+i);
+	}
+	//no room for the rest in one piece: fall back to single blocks
+	while(i<n && (out[i] = heap_malloc(size)) != NULL)
+		i++;
+	return i;
+}
+
+// carve up to n blocks of asize bytes off the front of free block bp in
+// one pass, freeing what is left; returns how many it made
+static int carve(char *bp, size_t asize, int n, void **out) {
+	size_t size = GET_SIZE(HDRP(bp));
+	unsigned int palloc = GET_PREV_ALLOC(HDRP(bp));
+	unsigned int zeroed = GET(HDRP(bp)) & ZEROED;
+	int i;
+	cut(bp);
+	for(i=0; i<n && size>=asize; i++) {
+		// a spare piece <16 bytes stays in the last block
+		size_t bsize = size-asize<2*DSIZE ? size : asize;
+		PUT(HDRP(bp), PACK(bsize, palloc|1));
+		adapt_count(bsize, 1);
+		out[i] = bp;
+		palloc = PREV_ALLOC;
+		bp += bsize;
+		size -= bsize;
+	}
+	if(size!=0) {
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC|zeroed));
+		PUT(FTRP(bp), PACK(size, PREV_ALLOC|zeroed));
+		connect(bp);
+	}
+	else GET(HDRP(bp)) |= PREV_ALLOC;
+	return i;
+}
+
+// order block pointers by address
+static int ptr_cmp(const void *a, const void *b) {
+	char *p = *(char * const *)a;
+	char *q = *(char * const *)b;
+	return (p > q) - (p < q);
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs[], merging neighbours among
+ *     them in one sweep. Sorts ptrs[] by address.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+	heap_lo = mem_heap_lo();
+	LOCK();
+	heap_free_batch(ptrs, n);
+	UNLOCK();
+}
+
+// heap_free_batch - free a batch, with the heap lock held
+static void heap_free_batch(void **ptrs, int n)
+{
+	int i = 0;
+	qsort(ptrs, n, sizeof(void *), ptr_cmp);
+	while(i<n) {
+		char *bp = ptrs[i++];
+		if(slab_owns(bp) || IS_MAPPED(bp)) {
+			heap_free(bp);
+			continue;
+		}
+		//swallow the run of blocks in the batch that directly follow bp,
+		//then coalesce the whole run with its neighbours once
+		size_t size = GET_SIZE(HDRP(bp));
+		adapt_count(size, -1);
+		while(i<n && (char *)ptrs[i] == bp+size) {
+			size_t next = GET_SIZE(HDRP(ptrs[i++]));
+			adapt_count(next, -1);
+			size += next;
+		}
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+		PUT(FTRP(bp), GET(HDRP(bp)));
+		CLR_NEXT_PALLOC(bp);
+		trim(coalesce(bp));
+	}
+}
+// coalesce free blocks; free blocks never touch, so the merged block
+// always follows an allocated one. The merged block is zeroed when all
+// its parts are, once the tags between them are wiped.
 static void *coalesce(void *bp) {
-	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
+	unsigned int zeroed = GET(HDRP(bp)) & ZEROED;
 	// next block is free block
 	if(prev_alloc && !next_alloc) {
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		cut(NEXT_BLKP(bp));
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
+		char *next = NEXT_BLKP(bp);
+		size += GET_SIZE(HDRP(next));
+		zeroed &= GET(HDRP(next));
+		cut(next);
+		if(zeroed)
+			wipe_seam(next);
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC|zeroed));
+		PUT(FTRP(bp), PACK(size, PREV_ALLOC|zeroed));
 	}
 	// prev block is free block
 	else if(!prev_alloc && next_alloc) {
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		cut(PREV_BLKP(bp));
-		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp); 
+		char *prev = PREV_BLKP(bp);
+		size += GET_SIZE(HDRP(prev));
+		zeroed &= GET(HDRP(prev));
+		cut(prev);
+		if(zeroed)
+			wipe_seam(bp);
+		bp = prev;
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC|zeroed));
+		PUT(FTRP(bp), PACK(size, PREV_ALLOC|zeroed));
 	}
 	// prev and next blocks are free blocks
 	else if(!prev_alloc && !next_alloc) {
-		size += (GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp))));
-		cut(PREV_BLKP(bp));
-		cut(NEXT_BLKP(bp));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp);
+		char *prev = PREV_BLKP(bp);
+		char *next = NEXT_BLKP(bp);
+		size += GET_SIZE(HDRP(prev)) + GET_SIZE(HDRP(next));
+		zeroed &= GET(HDRP(prev)) & GET(HDRP(next));
+		cut(prev);
+		cut(next);
+		if(zeroed) {
+			wipe_seam(bp);
+			wipe_seam(next);
+		}
+		bp = prev;
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC|zeroed));
+		PUT(FTRP(bp), PACK(size, PREV_ALLOC|zeroed));
 	}
+	rover_fix(bp, size);
 	connect(bp); // insert the new free block into segregated free list
 	
 	return bp;
 }
 
+// zero the tags around the start of free block bp, the footer before it,
+// its header and its links, as it merges into the zeroed block in front
+static void wipe_seam(char *bp) {
+	memset(bp - DSIZE, 0, 2*DSIZE);
+}
+
+// shrink bp once it has grown past TRIM_THRESHOLD
+static void trim(void *bp) {
+	if(GET_SIZE(HDRP(bp)) >= TRIM_THRESHOLD)
+		shrink(bp);
+}
+
+// give the free block bp back to memlib down to TRIM_KEEP bytes when it
+// ends the heap
+static void shrink(void *bp) {
+	size_t size = GET_SIZE(HDRP(bp));
+	if(size <= TRIM_KEEP || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+		return;
+	size_t release = size - TRIM_KEEP;
+	// mem_sbrk takes an int
+	if(release > INT_MAX)
+		release = INT_MAX & ~0x7;
+	unsigned int zeroed = GET(HDRP(bp)) & ZEROED;
+	cut(bp);
+	size -= release;
+	PUT(HDRP(bp), PACK(size, PREV_ALLOC|zeroed));
+	PUT(FTRP(bp), PACK(size, PREV_ALLOC|zeroed));
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));	// new epilogue header
+	connect(bp);
+	mem_sbrk(-(int)release);
+}
+
 // take out the block from the linked list and cut off the connection with other free blocks
 static void cut(void *bp) {
-	char *next;
-	char *prev;
-	// 'prev' pointer of next free block points to prev free block
-	if((next = NEXT_FREE(bp))!=NULL) {
-		PUT(next+WSIZE, *(unsigned int *)((char *)bp+WSIZE));
-	}
-	// 'next' pointer of prev free block points to next free block
-	if((prev = PREV_FREE(bp))!=NULL) {
-		PUT(prev-WSIZE, *(unsigned int *)bp);
-	}
-	// bp is the first element in the array of segregated free lists 
-	// array pointer points to next free block
+	int cls = CLASS(GET_SIZE(HDRP(bp)));
+	if(cls >= TREE_CLASS) {
+		tree_remove(&ROOT->free_list[cls], bp);
+	}
 	else {
-		size_t size = GET_SIZE(HDRP(bp));
-		int cnt = 0;
-		while(size!=0) {
-			size=size>>1;
-			cnt++;
+		char *next = NEXT_FREE(bp);
+		char *prev = PREV_FREE(bp);
+		// 'prev' pointer of next free block points to prev free block
+		if(next!=NULL) {
+			SET_PREV(next, prev);
+		}
+		// 'next' pointer of prev free block points to next free block
+		if(prev!=NULL) {
+			SET_NEXT(prev, next);
+		}
+		// bp is the first element in the array of segregated free lists 
+		// array pointer points to next free block
+		else {
+			ROOT->free_list[cls] = TO_OFF(next);
 		}
-		free_list[cnt-5] = *(unsigned int *)(bp);
 	}
+	if(ROOT->free_list[cls]==0)
+		MAP_CLR(cls);
 }
 
 // insert a new free block into segregated free list
 static void connect(void *bp) {
-	int cnt = 0;
 	size_t size = GET_SIZE(HDRP(bp));
-	size_t nsize = size;
-	// get the index according to the size of block
-	while(nsize!=0) {
-		nsize=nsize>>1;
-		cnt++;
+	int cls = CLASS(size);
+	MAP_SET(cls);
+	if(cls >= TREE_CLASS) {
+		tree_insert(&ROOT->free_list[cls], bp);
+		return;
 	}
+	char *head = TO_PTR(ROOT->free_list[cls]);
 	// insert the block in ascending order of sizes
-	if(free_list[cnt-5]==0 || size < GET_SIZE(HDRP((void *)free_list[cnt-5]))) {
-		if(free_list[cnt-5]!=0) {
-			PUT((char *)(free_list[cnt-5]) + WSIZE, (unsigned int)((char *)(bp)+WSIZE));
+	if(head==NULL || size < GET_SIZE(HDRP(head))) {
+		if(head!=NULL) {
+			SET_PREV(head, bp);
 		}	
-		PUT((char *)(bp)+WSIZE, 0);
-		PUT((char *)bp, free_list[cnt-5]);
-		free_list[cnt-5] = (unsigned int)bp;
+		SET_PREV(bp, NULL);
+		SET_NEXT(bp, head);
+		ROOT->free_list[cls] = TO_OFF(bp);
 	}
 	else {
-		char *cur = (char*)free_list[cnt-5];
-		while(GET(cur)!=0 && GET_SIZE(HDRP((void *)cur))<size) {
-			cur = (char *)GET(cur);
+		char *cur = head;
+		while(NEXT_FREE(cur)!=NULL && GET_SIZE(HDRP(NEXT_FREE(cur)))<size) {
+			cur = NEXT_FREE(cur);
 		}
-		if(GET(cur)==0) {
-			PUT(cur, (unsigned int)(bp));
-			PUT((char *)bp, 0);
-			PUT((char *)(bp)+WSIZE, (unsigned int)((char *)(cur)+WSIZE));
+		char *next = NEXT_FREE(cur);
+		SET_PREV(bp, cur);
+		SET_NEXT(bp, next);
+		if(next!=NULL) {
+			SET_PREV(next, bp);
+		}
+		SET_NEXT(cur, bp);
+	}
+}
+
+// treap priority of a block, a bijective hash of its offset
+static inline unsigned int tree_prio(char *bp) {
+	unsigned int h = TO_OFF(bp) * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+// insert bp below the last node of higher priority, splitting that
+// subtree around bp's key into bp's left and right children
+static void tree_insert(unsigned int *root, char *bp) {
+	unsigned int *link = root;
+	unsigned int prio = tree_prio(bp);
+	char *t;
+	while((t = TO_PTR(*link))!=NULL && tree_prio(t) > prio) {
+		link = TREE_LESS(bp, t) ? LEFT_LINK(t) : RIGHT_LINK(t);
+	}
+	*link = TO_OFF(bp);
+	unsigned int *l = LEFT_LINK(bp);
+	unsigned int *r = RIGHT_LINK(bp);
+	while(t!=NULL) {
+		if(TREE_LESS(t, bp)) {
+			*l = TO_OFF(t);
+			l = RIGHT_LINK(t);
+			t = RIGHT(t);
 		}
 		else {
-			PUT((char *)(bp)+WSIZE, (unsigned int)((char *)(cur)+WSIZE));
-			PUT((char *)(bp), GET(cur));
-			PUT((char *)(GET(cur))+WSIZE, (unsigned int)((char *)(bp)+WSIZE));
-			PUT(cur, (unsigned int)(bp));
+			*r = TO_OFF(t);
+			r = LEFT_LINK(t);
+			t = LEFT(t);
 		}
 	}
+	*l = 0;
+	*r = 0;
+}
+
+// unlink bp and merge its two subtrees in its place
+static void tree_remove(unsigned int *root, char *bp) {
+	unsigned int *link = root;
+	char *t;
+	while((t = TO_PTR(*link))!=bp) {
+		link = TREE_LESS(bp, t) ? LEFT_LINK(t) : RIGHT_LINK(t);
+	}
+	char *a = LEFT(bp);
+	char *b = RIGHT(bp);
+	while(a!=NULL && b!=NULL) {
+		if(tree_prio(a) > tree_prio(b)) {
+			*link = TO_OFF(a);
+			link = RIGHT_LINK(a);
+			a = RIGHT(a);
+		}
+		else {
+			*link = TO_OFF(b);
+			link = LEFT_LINK(b);
+			b = LEFT(b);
+		}
+	}
+	*link = TO_OFF(a!=NULL ? a : b);
+}
+
+// a block of at least asize bytes: the smallest one, lowest address among
+// equals, for best fit; the smallest of the first fit_k ones met on the way
+// down from the root for good fit, and the first one for first fit
+static char *tree_fit(unsigned int root, size_t asize) {
+	char *t = TO_PTR(root);
+	char *best = NULL;
+	int left = fit_policy==MM_GOOD_FIT ? fit_k : fit_policy==MM_FIRST_FIT ? 1 : INT_MAX;
+	while(t!=NULL) {
+		if(GET_SIZE(HDRP(t)) >= asize) {
+			best = t;
+			if(--left==0)
+				break;
+			t = LEFT(t);
+		}
+		else t = RIGHT(t);
+	}
+	return best;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc - Resize a block, in place where it can be: a shrink
+ *     splits off the tail, and a growth takes a free next block, a free
+ *     previous block (moving the data down), the heap top, or the slack
+ *     an earlier growth reserved. Only when none of those fit is the
+ *     block moved to a new one. Slab slots and mappings resize on their
+ *     own terms.
  */
 void *mm_realloc(void *ptr, size_t size)
 {
@@ -322,62 +1577,121 @@ void *mm_realloc(void *ptr, size_t size)
 	else if(size==0) {
 		mm_free(ptr); return NULL;					// free the block
 	}
+	heap_lo = mem_heap_lo();
+	LOCK();
+	void *newptr = heap_realloc(ptr, size);
+	UNLOCK();
+	return newptr;
+}
+
+// heap_realloc - resize a block in the heap, with the heap lock held
+static void *heap_realloc(void *ptr, size_t size)
+{
+	if(size > MAX_BLOCK - DSIZE) return NULL;	// too large for a 32-bit header
+	else if(slab_owns(ptr)) {
+		char *page = SLAB_BASE(ptr);
+		size_t slot = SLAB_SLOT(page);
+		if(size <= slot) return ptr;					// still fits in its slot
+		void *newptr;
+		if((newptr = heap_malloc(size)) == NULL)
+			return NULL;
+		memcpy(newptr, ptr, slot);
+		slab_free(ptr);
+		return newptr;
+	}
+	else if(IS_MAPPED(ptr)) {
+		void *newptr;
+		// a large block moves with its pages, a small one goes to the heap
+		if(size >= MMAP_THRESHOLD) {
+			size_t lead = MAP_LEAD(ptr);
+			if((newptr = mem_remap(MAP_BASE(ptr), lead + size + DSIZE)) == NULL)
+				return NULL;
+			return (char *)newptr + lead + DSIZE;
+		}
+		if((newptr = heap_malloc(size)) == NULL)
+			return NULL;
+		memcpy(newptr, ptr, size);				// the mapping holds at least MMAP_THRESHOLD bytes
+		mem_unmap(MAP_BASE(ptr));
+		return newptr;
+	}
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
     size_t oldsize = GET_SIZE(HDRP(oldptr));
-    size_t asize;
+    unsigned int palloc = GET_PREV_ALLOC(HDRP(oldptr));
+    unsigned int grown = GET(HDRP(oldptr)) & GROWN;
     // adjust block size to include overhead and alignment reqs.
-    if(size <= DSIZE)
-		asize = 2*DSIZE;
-	// round up
-	else asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    size_t asize = ADJUST(size);
 	
-	// if old size and new size are close, no need to reallocate
-	if(asize==oldsize || ((oldsize>asize)&&(oldsize-asize)<16)) {
+	// a block grown before will likely grow again, so reserve slack after it
+	if(grown && asize>oldsize) {
+		size_t slack = MIN(asize/100*slack_pct, slack_max);
+		// the slack stays in the heap: a block only gets a mapping for its
+		// size, which is what mm_free_sized expects of it
+		if(size < MMAP_THRESHOLD)
+			slack = asize < MMAP_THRESHOLD ? MIN(slack, MMAP_THRESHOLD - asize) : 0;
+		asize = MIN(ALIGN(asize+slack), MAX_BLOCK);
+	}
+	// if old size and new size are close, or a growing block shrinks back
+	// into its slack, no need to reallocate
+	if(asize==oldsize || ((oldsize>asize)&&(oldsize-asize)<16) ||
+			(grown && oldsize>asize && asize>oldsize/2)) {
 		return ptr;
 	}
 	// if old size is greater than new size, separate the old block
 	else if(oldsize>asize) {	
-		PUT(FTRP(ptr), PACK(oldsize-asize, 0));
-		PUT((char *)(ptr)+asize-WSIZE, PACK(oldsize-asize, 0));
-		PUT(HDRP(ptr), PACK(asize, 1));
-		PUT(FTRP(ptr), PACK(asize, 1));
+		adapt_count(oldsize, -1);
+		adapt_count(asize, 1);
+		PUT(HDRP(ptr), PACK(asize, palloc|1));
 		char *p = (char *)(ptr)+asize;
-		connect(p);
+		PUT(HDRP(p), PACK(oldsize-asize, PREV_ALLOC));
+		PUT(FTRP(p), PACK(oldsize-asize, PREV_ALLOC));
+		CLR_NEXT_PALLOC(p);
+		coalesce(p);							// the next block may be free too
 		return ptr;
 	}
-	// else need to allocate a new block
+	// else need to grow the block
 	else {
-		size_t nxt_size =  GET_SIZE(HDRP(NEXT_BLKP(ptr))); 			// check if we can use the next block directly
+		char *next = NEXT_BLKP(ptr);
+		size_t nxt_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+		size_t prv_size = palloc ? 0 : GET_SIZE((char *)ptr - DSIZE);
+		
+		// if the block is the last one, extend the heap by the shortfall only,
+		// unless it is growing past the point where it should be mapped
+		if(oldsize+nxt_size<asize && size<MMAP_THRESHOLD && GET_SIZE(HDRP(nxt_size ? NEXT_BLKP(next) : next))==0 &&
+				extend_heap(MAX(asize-oldsize-nxt_size, 2*DSIZE)/WSIZE) != NULL)
+			nxt_size = GET_SIZE(HDRP(next));	// the new space merged into next
 		
 		// if next block is free and the size is greater than requested size
-		if(GET_ALLOC(HDRP(NEXT_BLKP(ptr)))==0 && nxt_size+oldsize>=asize) {
-			void *nxt_p = NEXT_BLKP(ptr);
-			cut(nxt_p);							// cut off the connections with other free blocks
-			
-			// if the size of spare block <16, keep it as internal fragmentation
-			if(nxt_size+oldsize-asize<16) {
-				PUT(HDRP(ptr), PACK(nxt_size+oldsize, 1));
-				PUT(FTRP(ptr), PACK(nxt_size+oldsize, 1));
-			}
-			// else separate it as new free block
-			else {
-				PUT(HDRP(ptr), PACK(asize, 1));
-				PUT(FTRP(ptr), PACK(asize, 1));
-				void *free_p = (void *)((char *)ptr+asize);
-				PUT(HDRP(free_p), PACK(nxt_size+oldsize-asize, 0));
-				PUT(FTRP(free_p), PACK(nxt_size+oldsize-asize, 0));
-				connect(free_p); 				// insert the new free block into segregated free list
-			}
-			return ptr;
+		if(oldsize+nxt_size>=asize) {
+			cut(next);							// cut off the connections with other free blocks
+			adapt_count(oldsize, -1);
+			return realloc_place(ptr, oldsize+nxt_size, asize, palloc|GROWN);
+		}
+		// if the previous block is free too, slide the block back into it
+		else if(prv_size+oldsize+nxt_size>=asize) {
+			char *bp = PREV_BLKP(ptr);
+			cut(bp);
+			if(nxt_size!=0)
+				cut(next);
+			memmove(bp, ptr, oldsize-WSIZE);
+			adapt_count(oldsize, -1);
+			return realloc_place(bp, prv_size+oldsize+nxt_size, asize, GET_PREV_ALLOC(HDRP(bp))|GROWN);
+		}
+		// a parked neighbour may be all that is missing: sweep and retry
+		else if(ROOT->quick_bytes!=0) {
+			quick_flush();
+			return heap_realloc(ptr, size);
 		}
 		// allocate a new block and move all data from old block to new block
 		else {
-			newptr = mm_malloc(size);
+			if((newptr = heap_malloc(grown ? asize-WSIZE : size)) == NULL)
+				return NULL;
 		    copySize = GET_SIZE(HDRP(oldptr));
-		    memcpy(newptr, oldptr, copySize-DSIZE);
-		    mm_free(oldptr);
+		    memcpy(newptr, oldptr, copySize-WSIZE);
+		    heap_free(oldptr);
+		    if(!slab_owns(newptr) && !IS_MAPPED(newptr))
+		    	GET(HDRP(newptr)) |= GROWN;
 		    return newptr;
 		}
 	}
@@ -385,16 +1699,300 @@ void *mm_realloc(void *ptr, size_t size)
 
 }
 
+// finish growing a block in place: bp now spans size bytes, of which it
+// keeps asize and frees the rest
+static void *realloc_place(char *bp, size_t size, size_t asize, unsigned int palloc) {
+	rover_fix(bp, size);
+	// if the size of spare block <16, keep it as internal fragmentation
+	if(size-asize<16) {
+		PUT(HDRP(bp), PACK(size, palloc|1));
+		SET_NEXT_PALLOC(bp);
+	}
+	// else separate it as new free block
+	else {
+		PUT(HDRP(bp), PACK(asize, palloc|1));
+		char *p = bp+asize;
+		PUT(HDRP(p), PACK(size-asize, PREV_ALLOC));
+		PUT(FTRP(p), PACK(size-asize, PREV_ALLOC));
+		CLR_NEXT_PALLOC(p);
+		connect(p); 				// insert the new free block into segregated free list
+	}
+	adapt_count(GET_SIZE(HDRP(bp)), 1);
+	return bp;
+}
+
+// bytes to skip from bp to an align-byte boundary, leaving either
+// nothing or enough room for a free block in front
+static size_t align_lead(char *bp, size_t align) {
+	size_t lead = (align - (size_t)bp % align) % align;
+	if(lead!=0 && lead<2*DSIZE)
+		lead += align;
+	return lead;
+}
+
+// allocate a block of asize bytes whose payload is align-byte aligned,
+// returning the slack on both sides as free blocks
+static void *alloc_aligned(size_t asize, size_t align) {
+	// any free block this large holds an aligned block, whatever its address
+	size_t need = asize + align + 2*DSIZE;
+	char *bp;
+	if((bp = find_fit(need)) == NULL) {
+		// grow the heap only by what an aligned block at its top needs
+		char *brk = (char *)mem_heap_hi() + 1;
+		char *start = GET_PREV_ALLOC(brk - WSIZE) ? brk : PREV_BLKP(brk);
+		long ext = (start + align_lead(start, align) + asize) - brk;
+		if(ext<=0)
+			bp = start;
+		else if((bp = extend_heap(ext/WSIZE)) == NULL)
+			return NULL;
+	}
+	cut(bp);
+	size_t size = GET_SIZE(HDRP(bp));
+	unsigned int palloc = GET_PREV_ALLOC(HDRP(bp));
+	size_t lead = align_lead(bp, align);
+	if(lead!=0) {
+		PUT(HDRP(bp), PACK(lead, palloc));
+		PUT(FTRP(bp), PACK(lead, palloc));
+		connect(bp);
+		bp += lead;
+		palloc = 0;
+	}
+	size_t rest = size - lead - asize;
+	// if the trailing slack is <16, keep it as internal fragmentation
+	if(rest<2*DSIZE) {
+		asize += rest;
+		rest = 0;
+	}
+	PUT(HDRP(bp), PACK(asize, palloc|1));
+	if(rest!=0) {
+		char *p = bp + asize;
+		PUT(HDRP(p), PACK(rest, PREV_ALLOC));
+		PUT(FTRP(p), PACK(rest, PREV_ALLOC));
+		connect(p);
+	}
+	else SET_NEXT_PALLOC(bp);
+	adapt_count(asize, 1);
+	return bp;
+}
 
+// allocate a block in a mapping of its own, outside the heap
+static void *map_alloc(size_t size, size_t align) {
+	char *p;
+	size_t lead;
+	if((p = mem_map(size + align)) == NULL)
+		return NULL;
+	lead = (align - (size_t)(p + DSIZE) % align) % align;
+	PUT(p + lead, lead);
+	PUT(p + lead + WSIZE, PACK(0, 1));		// header of a mapped block
+	return p + lead + DSIZE;
+}
 
+// mark or clear page pg in the slab directory, growing it on demand
+static int slab_mark(unsigned int pg, int on) {
+	unsigned int *dir = (unsigned int *)TO_PTR(ROOT->slab_dir);
+	unsigned int words = dir!=NULL ? dir[0] : 0;
+	if(pg/32 >= words) {
+		if(!on)
+			return 0;
+		size_t nwords = MAX(2*words, MAX(pg/32+1, SLAB_DIR_MIN));
+		unsigned int *ndir = heap_malloc((nwords+1)*WSIZE);
+		if(ndir==NULL)
+			return -1;
+		memset(ndir, 0, (nwords+1)*WSIZE);
+		ndir[0] = nwords;
+		if(dir!=NULL) {
+			memcpy(ndir+1, dir+1, words*WSIZE);
+			// with threads, lock-free readers may still be using the old copy
+#ifndef MM_THREADS
+			heap_free(dir);
+#endif
+		}
+		__atomic_store_n(&ROOT->slab_dir, TO_OFF(ndir), __ATOMIC_RELEASE);
+		dir = ndir;
+	}
+	// slab_owns reads the bitmap without the lock
+	if(on)
+		__atomic_fetch_or(&dir[1 + pg/32], 1u << (pg%32), __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_and(&dir[1 + pg/32], ~(1u << (pg%32)), __ATOMIC_RELAXED);
+	return 0;
+}
 
+// is bp a slot of a slab page? safe without the heap lock for a block
+// the caller owns, since its page was marked before it was handed out
+static int slab_owns(void *bp) {
+	unsigned int *dir = (unsigned int *)TO_PTR(__atomic_load_n(&ROOT->slab_dir, __ATOMIC_ACQUIRE));
+	unsigned int pg = SLAB_PG(bp);
+	if(dir==NULL || pg/32 >= dir[0])
+		return 0;
+	return (__atomic_load_n(&dir[1 + pg/32], __ATOMIC_RELAXED) >> (pg%32)) & 1;
+}
 
+// unlink a slab page from the partial list of its class
+static void slab_unlink(char *page) {
+	int cls = SLAB_SLOT(page)/DSIZE - 1;
+	char *next = NEXT_FREE(page);
+	char *prev = PREV_FREE(page);
+	if(next!=NULL)
+		SET_PREV(next, prev);
+	if(prev!=NULL)
+		SET_NEXT(prev, next);
+	else
+		ROOT->slab_list[cls] = TO_OFF(next);
+}
 
+// push a slab page onto the partial list of its class
+static void slab_link(char *page) {
+	int cls = SLAB_SLOT(page)/DSIZE - 1;
+	char *head = TO_PTR(ROOT->slab_list[cls]);
+	SET_PREV(page, NULL);
+	SET_NEXT(page, head);
+	if(head!=NULL)
+		SET_PREV(head, page);
+	ROOT->slab_list[cls] = TO_OFF(page);
+}
 
+// carve a slot of the size class of size from a slab page
+static void *slab_alloc(size_t size) {
+	int cls = (size + DSIZE-1)/DSIZE - 1;
+	size_t slot = (cls+1)*DSIZE;
+	char *page = TO_PTR(ROOT->slab_list[cls]);
+	// no page with a free slot: set up a new one
+	if(page==NULL) {
+		if((page = alloc_aligned(SLAB_PAGE, SLAB_PAGE)) == NULL)
+			return NULL;
+		if(slab_mark(SLAB_PG(page), 1) < 0) {
+			heap_free(page);
+			return NULL;
+		}
+		SLAB_SLOT(page) = slot;
+		SLAB_NFREE(page) = SLAB_SLOTS(slot);
+		memset(SLAB_MAP(page), 0, SLAB_HDR - 4*WSIZE);
+		slab_link(page);
+	}
+	// first clear bit of the used-slot bitmap
+	unsigned int *map = SLAB_MAP(page);
+	int i = 0;
+	while(map[i]==~0u)
+		i++;
+	int idx = 32*i + __builtin_ctz(~map[i]);
+	map[i] |= 1u << (idx%32);
+	if(--SLAB_NFREE(page)==0)
+		slab_unlink(page);
+	return page + SLAB_HDR + idx*slot;
+}
 
+// release a slot, and its page once empty unless it is the only one left
+static void slab_free(void *bp) {
+	char *page = SLAB_BASE(bp);
+	size_t slot = SLAB_SLOT(page);
+	int idx = ((char *)bp - page - SLAB_HDR) / slot;
+	SLAB_MAP(page)[idx/32] &= ~(1u << (idx%32));
+	if(SLAB_NFREE(page)++==0)
+		slab_link(page);
+	if(SLAB_NFREE(page)==SLAB_SLOTS(slot) &&
+			(NEXT_FREE(page)!=NULL || PREV_FREE(page)!=NULL)) {
+		slab_unlink(page);
+		slab_mark(SLAB_PG(page), 0);
+		heap_free(page);
+	}
+}
 
+#ifdef MM_THREADS
+// flush the cache of an exiting thread back to the heap it came from
+static void cache_exit(void *unused) {
+	int i;
+	heap_lo = cache_heap;
+	if(heap_lo==NULL || ROOT->epoch != cache_epoch)
+		return;
+	LOCK();
+	for(i=0; i<CACHE_CLASSES; i++) {
+		while(cache_head[i]!=NULL) {
+			void *bp = cache_head[i];
+			cache_head[i] = *(void **)bp;
+			heap_free(bp);
+		}
+		cache_count[i] = 0;
+	}
+	UNLOCK();
+}
 
+static void cache_key_init(void) {
+	pthread_key_create(&cache_key, cache_exit);
+}
 
+// drop a cache left over from another heap or from before the last
+// mm_init; the thread must not switch arenas while it holds objects
+static inline void cache_check(void) {
+	if(cache_heap != heap_lo || cache_epoch != ROOT->epoch) {
+		memset(cache_head, 0, sizeof(cache_head));
+		memset(cache_count, 0, sizeof(cache_count));
+		if(cache_heap == NULL) {
+			pthread_once(&cache_once, cache_key_init);
+			pthread_setspecific(cache_key, (void *)1);
+		}
+		cache_heap = heap_lo;
+		cache_epoch = ROOT->epoch;
+	}
+}
 
+// take a small object from this thread's cache, refilling it from the heap
+static void *cache_alloc(size_t size) {
+	int i = (size + DSIZE-1)/DSIZE - 1;
+	void *bp;
+	cache_check();
+	if((bp = cache_head[i]) != NULL) {
+		cache_head[i] = *(void **)bp;
+		cache_count[i]--;
+		return bp;
+	}
+	// empty: fetch a batch of objects under a single lock acquisition
+	int n;
+	LOCK();
+	bp = heap_malloc((i+1)*DSIZE);
+	for(n=1; bp!=NULL && n<CACHE_BATCH; n++) {
+		void *p = heap_malloc((i+1)*DSIZE);
+		if(p==NULL)
+			break;
+		*(void **)p = cache_head[i];
+		cache_head[i] = p;
+		cache_count[i]++;
+	}
+	UNLOCK();
+	return bp;
+}
 
+// put an object in this thread's cache, flushing a batch when it is full
+static void cache_free(void *bp) {
+	int slab = slab_owns(bp);
+	// the lock holder may be flipping the PREV_ALLOC bit of this header
+	size_t size = slab ? 0 : __atomic_load_n((unsigned int *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7;
+	size_t cap = slab ? SLAB_SLOT(SLAB_BASE(bp)) : size - WSIZE;
+	int i = cap/DSIZE - 1;
+	if((!slab && size==0) || i >= CACHE_CLASSES) {	// size 0: a mapping
+		LOCK();
+		heap_free(bp);
+		UNLOCK();
+		return;
+	}
+	cache_put(bp, i);
+}
 
+// put an object that holds class i in this thread's cache
+static void cache_put(void *bp, int i) {
+	cache_check();
+	*(void **)bp = cache_head[i];
+	cache_head[i] = bp;
+	if(++cache_count[i] < CACHE_LIMIT)
+		return;
+	int n;
+	LOCK();
+	for(n=0; n<CACHE_BATCH; n++) {
+		bp = cache_head[i];
+		cache_head[i] = *(void **)bp;
+		heap_free(bp);
+	}
+	UNLOCK();
+	cache_count[i] -= CACHE_BATCH;
+}
+#endif